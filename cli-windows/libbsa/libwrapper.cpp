@@ -69,7 +69,7 @@ const unsigned int libbsa::LIBBSA_RETURN_MAX = libbsa::LIBBSA_ERROR_PARSE_FAIL;
 const unsigned int libbsa::LIBBSA_VERSION_TES3 = 0x00000001;
 const unsigned int libbsa::LIBBSA_VERSION_TES4 = 0x00000002;
 const unsigned int libbsa::LIBBSA_VERSION_TES5 = 0x00000004;
-const unsigned int libbsa::LIBBSA_VERSION_SSE  = 0x00000005;
+const unsigned int libbsa::LIBBSA_VERSION_SSE  = 0x00000008;
 /* Use only one compression flag. */
 const unsigned int libbsa::LIBBSA_COMPRESS_LEVEL_0 = 0x00000010;
 const unsigned int libbsa::LIBBSA_COMPRESS_LEVEL_1 = 0x00000020;
@@ -205,7 +205,7 @@ unsigned int BSANET::bsa_save(String^ path, const unsigned int flags) {
 
 	//Now remove version flag from flags and check for compression flag duplication.
 	compression = flags ^ version;
-	if (!(compression & (compression - 1)))
+	if (compression == 0 || (compression & (compression - 1)))
 		return c_error(LIBBSA_ERROR_INVALID_ARGS, "Invalid compression level specified.");
 
 	// convert path to char*
@@ -0,0 +1,124 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+#include "libbsa.h"
+#include "compression.h"
+
+#include <stdint.h>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+
+using std::cout;
+using std::endl;
+
+/* Measures decompression and compression throughput on real archives, for
+   comparing the deflate backends (see compression.h).
+
+   Usage: libbsa-benchmark [-l level] archive...
+
+   Every asset in each archive is extracted to memory, so the extraction figure
+   includes file I/O but is dominated by inflating compressed archives. The
+   extracted data is then deflated again at the given level (default 9). Run
+   each archive twice and use the second result if it is not already in the
+   OS's file cache. To compare backends, build the benchmark once with and once
+   without LIBBSA_USE_LIBDEFLATE and run both on the same archives.
+*/
+
+double MiBPerSecond(const uint64_t bytes, const std::chrono::steady_clock::duration& elapsed) {
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    if (seconds <= 0)
+        return 0;
+    return bytes / (1024.0 * 1024.0) / seconds;
+}
+
+int main(int argc, char * argv[]) {
+    int level = 9;
+    int firstPath = 1;
+    if (argc > 2 && std::string(argv[1]) == "-l") {
+        level = atoi(argv[2]);
+        firstPath = 3;
+    }
+
+    if (firstPath >= argc || level < 1 || level > 9) {
+        cout << "Usage: libbsa-benchmark [-l level] archive..." << endl;
+        return 1;
+    }
+
+    cout << "Deflate backend: " << libbsa::DeflateCodec::Name() << endl;
+
+    for (int i = firstPath; i < argc; i++) {
+        bsa_handle bh;
+        char ** assetPaths;
+        size_t numAssets;
+
+        cout << argv[i] << endl;
+
+        uint32_t ret = bsa_open(&bh, argv[i]);
+        if (ret == LIBBSA_OK)
+            ret = bsa_get_assets(bh, ".+", &assetPaths, &numAssets);
+        if (ret != LIBBSA_OK) {
+            cout << '\t' << "Could not read archive. Return code: " << ret << endl;
+            continue;
+        }
+
+        //Extract everything, keeping the data for the compression pass.
+        std::vector< std::pair<uint8_t*,size_t> > assets;
+        uint64_t totalSize = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t j = 0; j < numAssets; j++) {
+            uint8_t * data;
+            size_t size;
+            ret = bsa_extract_asset_to_memory(bh, assetPaths[j], &data, &size);
+            if (ret != LIBBSA_OK) {
+                cout << '\t' << "Could not extract \"" << assetPaths[j] << "\". Return code: " << ret << endl;
+                continue;
+            }
+            assets.push_back(std::make_pair(data, size));
+            totalSize += size;
+        }
+        std::chrono::steady_clock::duration extractTime = std::chrono::steady_clock::now() - start;
+
+        uint64_t compressedSize = 0;
+        std::vector<uint8_t> compressed;
+        start = std::chrono::steady_clock::now();
+        for (size_t j = 0, max = assets.size(); j < max; j++) {
+            libbsa::DeflateCodec::Deflate(assets[j].first, assets[j].second, level, compressed);
+            compressedSize += compressed.size();
+        }
+        std::chrono::steady_clock::duration compressTime = std::chrono::steady_clock::now() - start;
+
+        cout << '\t' << "Assets: " << assets.size() << ", uncompressed size: " << totalSize << " bytes" << endl
+             << '\t' << "Extraction: " << MiBPerSecond(totalSize, extractTime) << " MiB/s" << endl
+             << '\t' << "Deflate at level " << level << ": " << MiBPerSecond(totalSize, compressTime) << " MiB/s, "
+             << compressedSize << " bytes" << endl;
+
+        for (size_t j = 0, max = assets.size(); j < max; j++)
+            delete [] assets[j].first;
+        bsa_close(bh);
+    }
+
+    return 0;
+}
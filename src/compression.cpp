@@ -0,0 +1,239 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+#include "compression.h"
+#include "error.h"
+#ifndef _LIBBSA_WRAPPER_MODE
+	#include "libbsa.h"
+#else
+	#include "../cli-windows/libbsa/libwrapper.h"
+#endif
+#include <cstring>
+#include <zlib.h>
+#include <lz4frame.h>
+#ifdef LIBBSA_USE_LIBDEFLATE
+    #include <libdeflate.h>
+#endif
+
+using namespace std;
+
+namespace libbsa {
+
+    //////////////////////////////////////////////
+    // zlib
+    //////////////////////////////////////////////
+
+    void ZlibCodec::Inflate(libbsa::ifstream& in, const uint32_t compressedSize, uint8_t * out, const uint32_t outSize, const std::string& assetPath) {
+        static const size_t buffer_size = 32768;
+        uint8_t buffer[buffer_size];
+
+        z_stream strm;
+        strm.zalloc = Z_NULL;
+        strm.zfree = Z_NULL;
+        strm.opaque = Z_NULL;
+        strm.next_in = Z_NULL;
+        strm.avail_in = 0;
+        if (inflateInit(&strm) != Z_OK)
+            throw error(LIBBSA_ERROR_ZLIB_ERROR, "Uncompressing of \"" + assetPath + "\" failed.");
+
+        strm.next_out = out;
+        strm.avail_out = outSize;
+
+        uint32_t remaining = compressedSize;
+        int ret = Z_OK;
+        try {
+            while (ret == Z_OK) {
+                if (strm.avail_in == 0) {
+                    if (remaining == 0)
+                        break;  //Truncated stream.
+
+                    size_t blockSize = remaining < buffer_size ? remaining : buffer_size;
+                    in.read((char*)buffer, blockSize);
+                    remaining -= blockSize;
+
+                    strm.next_in = buffer;
+                    strm.avail_in = blockSize;
+                }
+
+                ret = inflate(&strm, Z_NO_FLUSH);
+            }
+        } catch (ios_base::failure&) {
+            inflateEnd(&strm);
+            throw;
+        }
+
+        inflateEnd(&strm);
+
+        if (ret != Z_STREAM_END || strm.total_out != outSize)
+            throw error(LIBBSA_ERROR_ZLIB_ERROR, "Uncompressing of \"" + assetPath + "\" failed.");
+    }
+
+    void ZlibCodec::Deflate(const uint8_t * in, const size_t inSize, const int level, std::vector<uint8_t>& out) {
+        uLongf outSize = compressBound(inSize);
+        out.resize(outSize);
+
+        if (compress2(&out[0], &outSize, in, inSize, level) != Z_OK)
+            throw error(LIBBSA_ERROR_ZLIB_ERROR, "Compression failed.");
+
+        out.resize(outSize);
+    }
+
+    const char * ZlibCodec::Name() {
+        return "zlib";
+    }
+
+#ifdef LIBBSA_USE_LIBDEFLATE
+    //////////////////////////////////////////////
+    // libdeflate
+    //////////////////////////////////////////////
+
+    //Each thread keeps a decompressor and a buffer for compressed data between calls, so inflating an asset doesn't
+    //usually allocate. The decompressor is freed when the thread exits.
+    struct LibdeflateInflateState {
+        LibdeflateInflateState() : decompressor(NULL) {}
+        ~LibdeflateInflateState() {
+            if (decompressor != NULL)
+                libdeflate_free_decompressor(decompressor);
+        }
+
+        libdeflate_decompressor * decompressor;
+        vector<uint8_t> compressed;
+    };
+
+    //The largest buffer a thread keeps. Larger assets are read into a buffer that is freed afterwards, so that a thread
+    //that once read a large asset doesn't hold on to that much memory for as long as it lives.
+    static const size_t maxKeptInflateBuffer = 1024 * 1024;
+
+    void LibdeflateCodec::Inflate(libbsa::ifstream& in, const uint32_t compressedSize, uint8_t * out, const uint32_t outSize, const std::string& assetPath) {
+        static thread_local LibdeflateInflateState state;
+        if (state.decompressor == NULL) {
+            state.decompressor = libdeflate_alloc_decompressor();
+            if (state.decompressor == NULL)
+                throw error(LIBBSA_ERROR_NO_MEM, "Could not allocate a decompressor.");
+        }
+
+        vector<uint8_t> large;
+        vector<uint8_t>& compressed = (compressedSize > maxKeptInflateBuffer ? large : state.compressed);
+        if (compressed.size() < compressedSize)
+            compressed.resize(compressedSize);
+
+        if (compressedSize > 0)
+            in.read((char*)&compressed[0], compressedSize);
+
+        libdeflate_result ret = libdeflate_zlib_decompress(state.decompressor, compressed.data(), compressedSize, out, outSize, NULL);  //NULL: output must fill out exactly.
+
+        if (ret != LIBDEFLATE_SUCCESS)
+            throw error(LIBBSA_ERROR_ZLIB_ERROR, "Uncompressing of \"" + assetPath + "\" failed.");
+    }
+
+    void LibdeflateCodec::Deflate(const uint8_t * in, const size_t inSize, const int level, std::vector<uint8_t>& out) {
+        libdeflate_compressor * compressor = libdeflate_alloc_compressor(level);
+        if (compressor == NULL)
+            throw error(LIBBSA_ERROR_NO_MEM, "Could not allocate a compressor.");
+
+        out.resize(libdeflate_zlib_compress_bound(compressor, inSize));
+        size_t outSize = libdeflate_zlib_compress(compressor, in, inSize, out.data(), out.size());
+
+        libdeflate_free_compressor(compressor);
+
+        if (outSize == 0)
+            throw error(LIBBSA_ERROR_ZLIB_ERROR, "Compression failed.");
+
+        out.resize(outSize);
+    }
+
+    const char * LibdeflateCodec::Name() {
+        return "libdeflate";
+    }
+#endif
+
+    //////////////////////////////////////////////
+    // LZ4 frame
+    //////////////////////////////////////////////
+
+    void Lz4FrameCodec::Inflate(libbsa::ifstream& in, const uint32_t compressedSize, uint8_t * out, const uint32_t outSize, const std::string& assetPath) {
+        static const size_t buffer_size = 32768;
+        uint8_t buffer[buffer_size];
+
+        LZ4F_dctx * dctx;
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+            throw error(LIBBSA_ERROR_ZLIB_ERROR, "Uncompressing of \"" + assetPath + "\" failed.");
+
+        uint32_t remaining = compressedSize;
+        size_t available = 0;  //Bytes in buffer not yet consumed.
+        size_t bufferPos = 0;
+        size_t written = 0;
+        size_t ret = 1;  //LZ4F_decompress() returns 0 once the frame is complete.
+        try {
+            while (ret != 0) {
+                if (available == 0) {
+                    if (remaining == 0)
+                        break;  //Truncated frame.
+
+                    size_t blockSize = remaining < buffer_size ? remaining : buffer_size;
+                    in.read((char*)buffer, blockSize);
+                    remaining -= blockSize;
+
+                    bufferPos = 0;
+                    available = blockSize;
+                }
+
+                size_t outAvailable = outSize - written;
+                size_t consumed = available;
+                ret = LZ4F_decompress(dctx, out + written, &outAvailable, buffer + bufferPos, &consumed, NULL);
+                if (LZ4F_isError(ret) || (outAvailable == 0 && consumed == 0))  //No progress means the output is full.
+                    break;
+
+                written += outAvailable;
+                bufferPos += consumed;
+                available -= consumed;
+            }
+        } catch (ios_base::failure&) {
+            LZ4F_freeDecompressionContext(dctx);
+            throw;
+        }
+
+        LZ4F_freeDecompressionContext(dctx);
+
+        if (ret != 0 || written != outSize)
+            throw error(LIBBSA_ERROR_ZLIB_ERROR, "Uncompressing of \"" + assetPath + "\" failed.");
+    }
+
+    void Lz4FrameCodec::Deflate(const uint8_t * in, const size_t inSize, const int level, std::vector<uint8_t>& out) {
+        LZ4F_preferences_t preferences;
+        memset(&preferences, 0, sizeof(LZ4F_preferences_t));
+        preferences.compressionLevel = level > 2 ? level : 0;  //0 is LZ4's fast mode.
+
+        out.resize(LZ4F_compressFrameBound(inSize, &preferences));
+
+        size_t outSize = LZ4F_compressFrame(&out[0], out.size(), in, inSize, &preferences);
+        if (LZ4F_isError(outSize))
+            throw error(LIBBSA_ERROR_ZLIB_ERROR, "Compression failed.");
+
+        out.resize(outSize);
+    }
+
+    const char * Lz4FrameCodec::Name() {
+        return "lz4";
+    }
+}
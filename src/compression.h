@@ -0,0 +1,88 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __LIBBSA_COMPRESSION_H__
+#define __LIBBSA_COMPRESSION_H__
+
+#include "streams.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Codecs for the compressed asset data stored in BSAs.
+
+   Each codec is a class of static functions with the same interface, so that
+   the BSA classes can use whichever one is selected at compile time without
+   paying for a virtual call:
+
+     Inflate(in, compressedSize, out, outSize, assetPath)
+        Decompresses the compressedSize bytes that start at the current position
+        of in, filling out, which must be exactly the uncompressed size.
+        assetPath is only used in error messages.
+
+     Deflate(in, inSize, level, out)
+        Compresses inSize bytes at in with the given level (1-9), replacing the
+        contents of out.
+
+     Name()
+        The name of the library that implements the codec.
+
+   DeflateCodec is the codec used for zlib-format data (TES4 and TES5 BSAs).
+   Defining LIBBSA_USE_LIBDEFLATE selects the libdeflate implementation,
+   otherwise the reference zlib implementation is used.
+
+   Lz4FrameCodec is the codec used for LZ4 frame data (Skyrim SE BSAs).
+*/
+
+namespace libbsa {
+
+    //Reference zlib. Input is read in fixed-size blocks, so the compressed data is never held in memory as a whole.
+    struct ZlibCodec {
+        static void Inflate(libbsa::ifstream& in, const uint32_t compressedSize, uint8_t * out, const uint32_t outSize, const std::string& assetPath);
+        static void Deflate(const uint8_t * in, const size_t inSize, const int level, std::vector<uint8_t>& out);
+        static const char * Name();
+    };
+
+#ifdef LIBBSA_USE_LIBDEFLATE
+    //libdeflate, which has SIMD-optimised whole-buffer (de)compression. It cannot
+    //stream, so the compressed data is read into memory before being inflated.
+    struct LibdeflateCodec {
+        static void Inflate(libbsa::ifstream& in, const uint32_t compressedSize, uint8_t * out, const uint32_t outSize, const std::string& assetPath);
+        static void Deflate(const uint8_t * in, const size_t inSize, const int level, std::vector<uint8_t>& out);
+        static const char * Name();
+    };
+
+    typedef LibdeflateCodec DeflateCodec;
+#else
+    typedef ZlibCodec DeflateCodec;
+#endif
+
+    //LZ4 frame format. Input is read in fixed-size blocks, as for ZlibCodec. Levels above 2 use LZ4 HC.
+    struct Lz4FrameCodec {
+        static void Inflate(libbsa::ifstream& in, const uint32_t compressedSize, uint8_t * out, const uint32_t outSize, const std::string& assetPath);
+        static void Deflate(const uint8_t * in, const size_t inSize, const int level, std::vector<uint8_t>& out);
+        static const char * Name();
+    };
+}
+
+#endif
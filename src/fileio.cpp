@@ -0,0 +1,272 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "fileio.h"
+#ifndef _LIBBSA_WRAPPER_MODE
+	#include "libbsa.h"
+#else
+	#include "../cli-windows/libbsa/libwrapper.h"
+#endif
+#include "error.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <boost/filesystem.hpp>
+
+#if defined(_WIN32) || defined(_WIN64)
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+namespace fs = boost::filesystem;
+
+namespace libbsa {
+
+    void SyncFile(const FileHandle file) {
+#if defined(_WIN32) || defined(_WIN64)
+        if (!FlushFileBuffers(file))
+            throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, "Could not flush file data to disk.");
+#else
+        if (fsync(file) != 0)
+            throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, "Could not flush file data to disk.");
+#endif
+    }
+
+    uint64_t CopyFileData(const FileHandle in, const uint64_t inOffset, const FileHandle out, const uint64_t outOffset, const uint64_t length) {
+        uint64_t copied = 0;
+#if defined(__linux__) && defined(SYS_copy_file_range)
+        //Called through syscall() so that building doesn't need a C library recent enough to wrap it.
+        //Linux copies within the kernel, and Btrfs, XFS and NFS can share or copy the data without reading it.
+        while (copied < length) {
+            loff_t inPos = inOffset + copied;
+            loff_t outPos = outOffset + copied;
+            const uint64_t chunk = (length - copied < 0x40000000 ? length - copied : 0x40000000);
+            long ret = syscall(SYS_copy_file_range, in, &inPos, out, &outPos, (size_t)chunk, 0u);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+                break;  //Unsupported for these files, so the caller copies the rest.
+            copied += ret;
+        }
+#endif
+        return copied;
+    }
+
+    void CopyData(libbsa::ifstream& in, const uint64_t inOffset, std::ostream& out, const FileHandle outHandle, const uint64_t outOffset, const uint64_t length, std::vector<uint8_t>& buffer) {
+        if (length == 0)
+            return;
+
+        out.flush();  //The copy bypasses the stream, so anything it has buffered must be written first.
+        uint64_t copied = CopyFileData(in->handle(), inOffset, outHandle, outOffset, length);
+        if (copied > 0)
+            out.seekp(outOffset + copied, ios_base::beg);
+
+        if (copied < length && (uint64_t)in.tellg() != inOffset + copied)
+            in.seekg(inOffset + copied, ios_base::beg);
+        for (uint64_t chunk; copied < length; copied += chunk) {
+            chunk = (length - copied < buffer.size() ? length - copied : buffer.size());
+            in.read((char*)&buffer[0], chunk);
+            out.write((char*)&buffer[0], chunk);
+        }
+    }
+
+    void ReadFileData(const FileHandle file, const uint64_t offset, uint8_t * buffer, const size_t length) {
+        for (size_t done = 0; done < length;) {
+#if defined(_WIN32) || defined(_WIN64)
+            const uint64_t position = offset + done;
+            OVERLAPPED overlapped;
+            memset(&overlapped, 0, sizeof(overlapped));
+            overlapped.Offset = (DWORD)position;
+            overlapped.OffsetHigh = (DWORD)(position >> 32);
+
+            DWORD count = 0;
+            const DWORD chunk = (length - done < 0x40000000 ? (DWORD)(length - done) : 0x40000000);
+            if (!ReadFile(file, buffer + done, chunk, &count, &overlapped) || count == 0)
+                throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, "Could not read back file data.");
+#else
+            ssize_t count = pread(file, buffer + done, length - done, offset + done);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, "Could not read back file data.");
+#endif
+            done += count;
+        }
+    }
+
+#if defined(O_DIRECT)
+    //A thread's file opened for direct I/O, and its aligned buffer, kept between reads as opening the file and
+    //allocating the buffer cost more than reading a typical asset. The file is reopened if the path changes, or
+    //if the path now names a different file, eg. because the BSA has since been saved over it.
+    struct DirectFile {
+        DirectFile() : file(-1), chunk(NULL) {}
+        ~DirectFile() {
+            Close();
+            free(chunk);
+        }
+
+        void Close() {
+            if (file >= 0)
+                close(file);
+            file = -1;
+        }
+
+        bool Open(const std::string& newPath) {
+            struct stat pathStat, fileStat;
+            if (file >= 0 && newPath == path && stat(newPath.c_str(), &pathStat) == 0 && fstat(file, &fileStat) == 0
+                && pathStat.st_dev == fileStat.st_dev && pathStat.st_ino == fileStat.st_ino)
+                return true;
+
+            Close();
+            file = open(newPath.c_str(), O_RDONLY | O_DIRECT);
+            path = newPath;
+            return file >= 0;
+        }
+
+        std::string path;
+        int file;
+        void * chunk;
+    };
+#endif
+
+    bool ReadFileDirect(const std::string& path, const uint64_t offset, uint8_t * buffer, const size_t length) {
+#if defined(O_DIRECT)
+        //Direct reads must start and end on logical block boundaries and go into memory aligned the same way. Data that
+        //is aligned is read straight into the buffer, and the rest through whole blocks read into an aligned buffer.
+        //4 KiB satisfies all common devices.
+        const uint64_t alignment = 4096;
+        const size_t chunkSize = 4 * 1024 * 1024;
+
+        static thread_local DirectFile direct;
+        if (!direct.Open(path))
+            return false;
+
+        for (size_t copied = 0; copied < length;) {
+            const uint64_t position = offset + copied;
+            const size_t aligned = (length - copied) & ~(alignment - 1);
+            if (aligned > 0 && (position & (alignment - 1)) == 0 && ((uintptr_t)(buffer + copied) & (alignment - 1)) == 0) {
+                ssize_t ret = pread(direct.file, buffer + copied, (aligned < 0x40000000 ? aligned : 0x40000000), position);
+                if (ret < 0 && errno == EINTR)
+                    continue;
+                if (ret <= 0)
+                    return false;  //Unsupported by the filesystem, or the data is past the end of the file.
+                copied += ret;
+                continue;
+            }
+
+            if (direct.chunk == NULL && posix_memalign(&direct.chunk, alignment, chunkSize) != 0) {
+                direct.chunk = NULL;
+                return false;
+            }
+
+            const uint64_t start = position & ~(alignment - 1);
+            const size_t skip = position - start;
+            uint64_t toRead = (skip + length - copied + alignment - 1) & ~(alignment - 1);
+            if (toRead > chunkSize)
+                toRead = chunkSize;
+
+            ssize_t ret = pread(direct.file, direct.chunk, toRead, start);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= (ssize_t)skip)
+                return false;
+
+            size_t count = ret - skip;
+            if (count > length - copied)
+                count = length - copied;
+            memcpy(buffer + copied, (uint8_t*)direct.chunk + skip, count);
+            copied += count;
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    AtomicFile::AtomicFile(const std::string& path) : path(path), committed(false) {
+        //The temporary file must be on the same filesystem as the path for the rename to be atomic.
+        try {
+            tempPath = fs::unique_path(fs::path(path + ".%%%%-%%%%.tmp")).string();
+            out.open(fs::path(tempPath), ios::in | ios::out | ios::binary | ios::trunc);
+        } catch (fs::filesystem_error& e) {
+            throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
+        } catch (ios_base::failure& e) {
+            throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, "Could not create a temporary file for \"" + path + "\": " + e.what());
+        }
+    }
+
+    AtomicFile::~AtomicFile() {
+        if (committed)
+            return;
+
+        try {
+            if (out.is_open())
+                out.close();
+        } catch (...) {}
+
+        boost::system::error_code ec;
+        fs::remove(tempPath, ec);
+    }
+
+    libbsa::fstream& AtomicFile::Stream() {
+        return out;
+    }
+
+    FileHandle AtomicFile::Handle() {
+        return out->handle();
+    }
+
+    void AtomicFile::Commit() {
+        out.flush();
+        SyncFile(out->handle());
+        out.close();
+
+#if defined(_WIN32) || defined(_WIN64)
+        if (!MoveFileExW(fs::path(tempPath).c_str(), fs::path(path).c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+            throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, "Could not replace \"" + path + "\".");
+#else
+        try {
+            fs::rename(tempPath, path);
+        } catch (fs::filesystem_error& e) {
+            throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
+        }
+
+        //The rename is only durable once the directory holding the file is synced too. Not all filesystems
+        //allow directories to be synced, and the data itself is safe by now, so failures are ignored.
+        fs::path parent = fs::path(path).parent_path();
+        int dir = open(parent.empty() ? "." : parent.c_str(), O_RDONLY);
+        if (dir >= 0) {
+            fsync(dir);
+            close(dir);
+        }
+#endif
+        committed = true;
+    }
+}
@@ -0,0 +1,83 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __LIBBSA_FILEIO_H__
+#define __LIBBSA_FILEIO_H__
+
+#include "streams.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+namespace libbsa {
+
+    typedef boost::iostreams::file_descriptor::handle_type FileHandle;
+
+    //Flushes a file's data to storage, so that it survives a crash or power loss.
+    void SyncFile(const FileHandle file);
+
+    //Copies length bytes from in at inOffset to out at outOffset without the data passing through user space, and
+    //without changing either file's position. Filesystems that support it share the data between the files rather
+    //than copying it. Returns the number of bytes copied, which is less than length if this isn't possible for the
+    //files (or at all, on platforms without the system call), in which case the rest must be copied by the caller.
+    uint64_t CopyFileData(const FileHandle in, const uint64_t inOffset, const FileHandle out, const uint64_t outOffset, const uint64_t length);
+
+    //Copies length bytes of in from inOffset to out, which writes to outHandle and is positioned at outOffset. The data is
+    //copied using CopyFileData() where possible, and otherwise through the given buffer.
+    void CopyData(libbsa::ifstream& in, const uint64_t inOffset, std::ostream& out, const FileHandle outHandle, const uint64_t outOffset, const uint64_t length, std::vector<uint8_t>& buffer);
+
+    //Reads length bytes of file from offset into buffer, without using a stream. The file's position is undefined
+    //afterwards, so any stream using it must be repositioned before it is used again.
+    void ReadFileData(const FileHandle file, const uint64_t offset, uint8_t * buffer, const size_t length);
+
+    //Reads length bytes of path from offset into buffer using direct I/O, which bypasses the OS's file cache. The aligned
+    //range of blocks holding the data is read, so data that starts and ends on a block boundary is read without waste, and
+    //straight into buffer if it is aligned too. Each thread keeps the file it last read open for its next read.
+    //Returns false if direct I/O isn't supported for the file (or at all, on platforms without it), in which case the data
+    //must be read normally.
+    bool ReadFileDirect(const std::string& path, const uint64_t offset, uint8_t * buffer, const size_t length);
+
+    //Output file that is written to a temporary file alongside its path, and only moved into place by Commit(),
+    //once it is complete and on disk. If the file isn't committed, eg. because an error is thrown while writing
+    //it, the temporary file is deleted and any existing file at the path is left untouched. The temporary file is
+    //also open for reading, so that data already written to it can be read back.
+    class AtomicFile {
+    public:
+        AtomicFile(const std::string& path);
+        ~AtomicFile();
+
+        libbsa::fstream& Stream();
+        FileHandle Handle();
+
+        void Commit();  //Syncs and closes the temporary file, then renames it over the path.
+    private:
+        std::string path;
+        std::string tempPath;
+        libbsa::fstream out;
+        bool committed;
+    };
+}
+
+#endif
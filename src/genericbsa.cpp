@@ -29,8 +29,17 @@
 #endif
 #include "error.h"
 #include "streams.h"
+#include "threadpool.h"
+#include "fileio.h"
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <system_error>
+#include <thread>
 #include <boost/filesystem.hpp>
 #include <boost/crc.hpp>
+#include <boost/unordered_set.hpp>
 
 namespace fs = boost::filesystem;
 
@@ -43,18 +52,42 @@ namespace libbsa {
     //////////////////////////////////////////////
 
     BsaAsset::BsaAsset() : hash(0), size(0), offset(0) {}
+
+    //////////////////////////////////////////////
+    // AsyncResult Constructor
+    //////////////////////////////////////////////
+
+    AsyncResult::AsyncResult() : requestId(0), code(LIBBSA_OK), data(NULL), size(0) {}
+
+    //////////////////////////////////////////////
+    // SaveBlock Constructor
+    //////////////////////////////////////////////
+
+    SaveBlock::SaveBlock() : source(NULL), externalPath(NULL), merged(NULL), transcode(false), compress(false), size(0), offset(0) {}
+
+    //////////////////////////////////////////////
+    // StoredBlock Constructor
+    //////////////////////////////////////////////
+
+    StoredBlock::StoredBlock() : asset(NULL), offset(0), size(0) {}
 }
 
 //////////////////////////////////////////////
 // BSA Class Methods
 //////////////////////////////////////////////
 
-_bsa_handle_int::_bsa_handle_int(const std::string& path) : filePath(path), extAssets(NULL), extAssetsNum(0) {}
+_bsa_handle_int::_bsa_handle_int(const std::string& path) : extAssets(NULL), extAssetsNum(0), filePath(path), compressionThreshold(0.05f), dataOrder(DATA_ORDER_HASH), deduplicate(false), deduplicatedBytes(0), dataAlignment(0), alignmentMinSize(0), directReadThreshold(0), lastRequestId(0) {}
 
 _bsa_handle_int::~_bsa_handle_int() {
     for (size_t i=0; i < extAssetsNum; i++)
         delete [] extAssets[i];
     delete [] extAssets;
+
+    //Derived class data is already gone, so pending requests must have been waited on, and requests' destructor finds none.
+
+    //Free any results that were never collected.
+    for (deque<AsyncResult>::iterator it = completedRequests.begin(), endIt = completedRequests.end(); it != endIt; ++it)
+        delete [] it->data;
 }
 
 bool _bsa_handle_int::HasAsset(const std::string& assetPath) {
@@ -82,11 +115,68 @@ void _bsa_handle_int::GetMatchingAssets(const boost::regex& regex, std::list<Bsa
     }
 }
 
+const std::string& _bsa_handle_int::GetPath() const {
+    return filePath;
+}
+
+void _bsa_handle_int::GetStoredBlocks(std::vector<StoredBlock>& blocks) const {
+    blocks.clear();
+    for (list<BsaAsset>::const_iterator it = assets.begin(), endIt = assets.end(); it != endIt; ++it) {
+        if (it->offset == 0)  //Not written yet.
+            continue;
+        StoredBlock block;
+        block.asset = &*it;
+        block.offset = it->offset;
+        block.size = StoredSize(*it);
+        blocks.push_back(block);
+    }
+    sort(blocks.begin(), blocks.end(), [](const StoredBlock& first, const StoredBlock& second) {
+        if (first.offset != second.offset)
+            return first.offset < second.offset;
+        return first.size < second.size;
+    });
+}
+
+uint64_t _bsa_handle_int::StoredSize(const BsaAsset& asset) const {
+    return asset.size;
+}
+
+bool _bsa_handle_int::IsCompressed(const BsaAsset& /*data*/) const {
+    return false;
+}
+
+bool _bsa_handle_int::CanCopyStoredDataFrom(const _bsa_handle_int& /*other*/) const {
+    return false;
+}
+
+void _bsa_handle_int::HashPaths(const std::vector<const std::string*>& assetPaths, std::vector<uint64_t>& hashes) {
+    hashes.resize(assetPaths.size());
+    for (size_t i=0, max=assetPaths.size(); i < max; i++)
+        hashes[i] = HashPath(*assetPaths[i]);
+}
+
+void _bsa_handle_int::VerifyIndexHashes(const std::vector<const BsaAsset*>& checked, const std::vector<const std::string*>& /*hashedPaths*/, HashReport& report) {
+    //Runs of assets with the same hash collide. The hashes are sorted with their asset indices, to keep the sort in cache.
+    //Their halves are swapped so that assets read from the BSA, which records are ordered by the low half of the hash
+    //first, are already sorted.
+    vector< pair<uint64_t, size_t> > sorted(checked.size());
+    for (size_t i=0, max=checked.size(); i < max; i++)
+        sorted[i] = make_pair((checked[i]->hash << 32) | (checked[i]->hash >> 32), i);
+    if (!is_sorted(sorted.begin(), sorted.end()))
+        sort(sorted.begin(), sorted.end());
+    for (size_t i=0, max=sorted.size(); i < max; i++) {
+        if ((i > 0 && sorted[i].first == sorted[i - 1].first) || (i + 1 < max && sorted[i].first == sorted[i + 1].first))
+            report.colliding.push_back(checked[sorted[i].second]->path);
+    }
+}
+
 void _bsa_handle_int::Extract(const std::string& assetPath, uint8_t** _data, size_t* _size) {
     //Get asset data.
     BsaAsset data = GetAsset(assetPath);
     if (data.path.empty())
         throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, "Path is empty.");
+    else if (data.offset == 0)
+        throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + assetPath + "\" has not been saved to the BSA yet.");
 
 	std::pair<uint8_t*,size_t> dataPair;
     try {
@@ -112,6 +202,8 @@ void _bsa_handle_int::Extract(const std::string& assetPath, const std::string& o
     BsaAsset data = GetAsset(assetPath);
     if (data.path.empty())
         throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, "Path is empty.");
+    else if (data.offset == 0)
+        throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + assetPath + "\" has not been saved to the BSA yet.");
 
     std::pair<uint8_t*,size_t> dataPair;
     std::string outFilePath = outPath + '/' + data.path;
@@ -158,6 +250,9 @@ void _bsa_handle_int::Extract(const list<BsaAsset>& assetsToExtract, const std::
         for (list<BsaAsset>::const_iterator it = assetsToExtract.begin(), endIt = assetsToExtract.end(); it != endIt; ++it) {
             std::string outFilePath = outPath + '/' + it->path;
 
+            if (it->offset == 0)
+                throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + it->path + "\" has not been saved to the BSA yet.");
+
             //Create parent directories.
             fs::create_directories(fs::path(outPath).parent_path());  //This creates any directories in the path that don't already exist.
 
@@ -191,6 +286,8 @@ uint32_t _bsa_handle_int::CalcChecksum(const std::string& assetPath) {
     BsaAsset data = GetAsset(assetPath);
     if (data.path.empty())
         throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, "Path is empty.");
+    else if (data.offset == 0)
+        throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + assetPath + "\" has not been saved to the BSA yet.");
 
     std::pair<uint8_t*,size_t> dataPair;
     try {
@@ -214,3 +311,1055 @@ uint32_t _bsa_handle_int::CalcChecksum(const std::string& assetPath) {
         throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
     }
 }
+
+void _bsa_handle_int::VerifyHashes(HashReport& report) {
+    report.mismatched.clear();
+    report.colliding.clear();
+
+    //The games normalise paths before hashing them, so stored names may be in any case. Most are already
+    //lowercase, so only those that aren't are copied.
+    vector<const BsaAsset*> checked;
+    vector<const string*> paths;
+    deque<string> fixedPaths;
+    string buffer;
+    checked.reserve(assets.size());
+    paths.reserve(assets.size());
+    for (list<BsaAsset>::const_iterator it = assets.begin(), endIt = assets.end(); it != endIt; ++it) {
+        checked.push_back(&*it);
+        FixPath(it->path.c_str(), buffer);
+        if (buffer == it->path)
+            paths.push_back(&it->path);
+        else {
+            fixedPaths.push_back(buffer);
+            paths.push_back(&fixedPaths.back());
+        }
+    }
+
+    //Hashing is quick enough that starting the worker pool only pays off for large BSAs. Otherwise the paths are
+    //hashed in one chunk per worker, each written to its own part of hashes.
+    vector<uint64_t> hashes;
+    const size_t minParallelPaths = 16384;
+    if (paths.size() < minParallelPaths)
+        HashPaths(paths, hashes);
+    else {
+        hashes.resize(paths.size());
+        mutex errorMutex;  //Guards the error details.
+        unsigned int errorCode = LIBBSA_OK;
+        string errorMessage;
+        TaskGroup tasks;  //Declared after what the tasks use, so that if submitting throws, it waits for them before that is destroyed.
+        const size_t threads = ThreadPool::Shared().Size();
+        const size_t chunkSize = (paths.size() + threads - 1) / threads;
+        for (size_t start=0, max=paths.size(); start < max; start += chunkSize) {
+            const size_t end = (start + chunkSize < max ? start + chunkSize : max);
+            tasks.Submit([this, start, end, &paths, &hashes, &errorMutex, &errorCode, &errorMessage]() {
+                unsigned int code = LIBBSA_OK;
+                string message;
+                try {
+                    const vector<const string*> chunk(paths.begin() + start, paths.begin() + end);
+                    vector<uint64_t> chunkHashes;
+                    HashPaths(chunk, chunkHashes);
+                    copy(chunkHashes.begin(), chunkHashes.end(), hashes.begin() + start);
+                } catch (error& e) {
+                    code = e.code();
+                    message = e.what();
+                } catch (bad_alloc& e) {
+                    code = LIBBSA_ERROR_NO_MEM;
+                    message = e.what();
+                } catch (exception& e) {
+                    code = LIBBSA_ERROR_BAD_STRING;  //Hashing only fails if a path can't be converted.
+                    message = e.what();
+                } catch (...) {
+                    code = LIBBSA_ERROR_BAD_STRING;
+                    message = "Unknown error.";
+                }
+
+                if (code != LIBBSA_OK) {
+                    lock_guard<mutex> lock(errorMutex);
+                    if (errorCode == LIBBSA_OK) {
+                        errorCode = code;
+                        errorMessage = message;
+                    }
+                }
+            });
+        }
+        tasks.Wait();
+
+        if (errorCode != LIBBSA_OK)
+            throw error(errorCode, errorMessage);
+    }
+
+    for (size_t i=0, max=checked.size(); i < max; i++) {
+        if (hashes[i] != checked[i]->hash)
+            report.mismatched.push_back(checked[i]->path);
+    }
+
+    VerifyIndexHashes(checked, paths, report);
+
+    //An asset may be reported more than once, eg. if its hash and its folder's hash are both wrong.
+    sort(report.mismatched.begin(), report.mismatched.end());
+    report.mismatched.erase(unique(report.mismatched.begin(), report.mismatched.end()), report.mismatched.end());
+    sort(report.colliding.begin(), report.colliding.end());
+    report.colliding.erase(unique(report.colliding.begin(), report.colliding.end()), report.colliding.end());
+}
+
+uint32_t _bsa_handle_int::ExtractAsync(const std::string& assetPath, const AsyncCallback& callback) {
+    return SubmitRequest([this, assetPath](AsyncResult& result) {
+        Extract(assetPath, &result.data, &result.size);
+    }, callback);
+}
+
+uint32_t _bsa_handle_int::ExtractAsync(const std::string& assetPath, const std::string& destPath, const bool overwrite, const AsyncCallback& callback) {
+    return SubmitRequest([this, assetPath, destPath, overwrite](AsyncResult&) {
+        Extract(assetPath, destPath, overwrite);
+    }, callback);
+}
+
+bool _bsa_handle_int::PollCompleted(AsyncResult& result) {
+    lock_guard<mutex> lock(asyncMutex);
+    if (completedRequests.empty())
+        return false;
+
+    result = completedRequests.front();
+    completedRequests.pop_front();
+    return true;
+}
+
+void _bsa_handle_int::WaitForRequests() {
+    requests.Wait();
+}
+
+uint32_t _bsa_handle_int::SubmitRequest(const std::function<void(AsyncResult&)>& request, const AsyncCallback& callback) {
+    uint32_t requestId;
+    {
+        lock_guard<mutex> lock(asyncMutex);
+        requestId = ++lastRequestId;
+    }
+
+    requests.Submit([this, requestId, request, callback]() {
+        AsyncResult result;
+        result.requestId = requestId;
+        try {
+            request(result);
+        } catch (error& e) {
+            result.code = e.code();
+            result.message = e.what();
+        } catch (ios_base::failure& e) {
+            result.code = LIBBSA_ERROR_FILESYSTEM_ERROR;
+            result.message = e.what();
+        } catch (fs::filesystem_error& e) {
+            result.code = LIBBSA_ERROR_FILESYSTEM_ERROR;
+            result.message = e.what();
+        } catch (bad_alloc& e) {
+            result.code = LIBBSA_ERROR_NO_MEM;
+            result.message = e.what();
+        } catch (exception& e) {
+            result.code = LIBBSA_ERROR_FILESYSTEM_ERROR;
+            result.message = e.what();
+        } catch (...) {
+            result.code = LIBBSA_ERROR_FILESYSTEM_ERROR;
+            result.message = "Unknown error.";
+        }
+
+        //Nothing may be thrown out of the pool, so exceptions from the callback are dropped.
+        if (callback) {
+            try {
+                callback(result);
+            } catch (...) {}
+        } else {
+            lock_guard<mutex> lock(asyncMutex);
+            completedRequests.push_back(result);
+        }
+    });
+
+    return requestId;
+}
+
+void _bsa_handle_int::AddAsset(const std::string& extPath, const std::string& assetPath) {
+    if (assetPath.empty())
+        throw error(LIBBSA_ERROR_INVALID_ARGS, "Path is empty.");
+    else if (HasAsset(assetPath))
+        throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + assetPath + "\" is already in the BSA.");
+
+    list<PendingBsaAsset> newAssets(1);
+    newAssets.back().extPath = extPath;
+    newAssets.back().intPath = assetPath;
+
+    list<BsaAsset> newIndex;
+    IndexPendingAssets(newAssets, newIndex);
+
+    assets.splice(assets.end(), newIndex);
+    pendingAssets.splice(pendingAssets.end(), newAssets);
+}
+
+void _bsa_handle_int::SetAssets(const std::list<PendingBsaAsset>& newAssets) {
+    //Check for duplicates before anything is changed.
+    boost::unordered_set<std::string> paths;
+    for (list<PendingBsaAsset>::const_iterator it = newAssets.begin(), endIt = newAssets.end(); it != endIt; ++it) {
+        if (it->intPath.empty())
+            throw error(LIBBSA_ERROR_INVALID_ARGS, "Path is empty.");
+        else if (!paths.insert(it->intPath).second)
+            throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + it->intPath + "\" is given more than once.");
+    }
+
+    list<BsaAsset> newIndex;
+    IndexPendingAssets(newAssets, newIndex);
+
+    assets.swap(newIndex);
+    pendingAssets = newAssets;
+    mergedAssets.clear();
+}
+
+void _bsa_handle_int::SetAssetsFromDirectory(const std::string& sourceDir) {
+    try {
+        if (!fs::is_directory(sourceDir))
+            throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, "\"" + sourceDir + "\" is not a directory.");
+    } catch (fs::filesystem_error& e) {
+        throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
+    }
+
+    //Each directory is listed by its own task, which queues tasks for its subdirectories, so the tree is
+    //walked by all the workers at once. Files' asset paths are normalised and hashed as they are found.
+    vector< pair<PendingBsaAsset, BsaAsset> > found;
+    mutex foundMutex;  //Guards found and the error details.
+    unsigned int errorCode = LIBBSA_OK;
+    string errorMessage;
+
+    TaskGroup tasks;
+    function<void(const fs::path&, const string&)> walk;
+    walk = [this, &walk, &tasks, &found, &foundMutex, &errorCode, &errorMessage](const fs::path& dir, const string& prefix) {
+        try {
+            vector< pair<PendingBsaAsset, BsaAsset> > files;
+            for (fs::directory_iterator it(dir), endIt; it != endIt; ++it) {
+                const string name = prefix + it->path().filename().string();
+
+                //Symlinked directories are not followed, so that links can't make the walk loop.
+                if (fs::is_directory(it->symlink_status())) {
+                    const fs::path subdir = it->path();
+                    const string subdirPrefix = name + '/';
+                    tasks.Submit([&walk, subdir, subdirPrefix]() { walk(subdir, subdirPrefix); });
+                } else if (fs::is_regular_file(it->status())) {
+                    pair<PendingBsaAsset, BsaAsset> file;
+                    file.first.extPath = it->path().string();
+                    FixPath(name.c_str(), file.first.intPath);
+                    file.second.path = file.first.intPath;
+                    files.push_back(file);
+                }
+            }
+
+            //The directory's files are hashed together, which also checks that their paths can be encoded.
+            vector<const string*> paths(files.size());
+            for (size_t i=0, max=files.size(); i < max; i++)
+                paths[i] = &files[i].second.path;
+            vector<uint64_t> hashes;
+            HashPaths(paths, hashes);
+            for (size_t i=0, max=files.size(); i < max; i++)
+                files[i].second.hash = hashes[i];
+
+            lock_guard<mutex> lock(foundMutex);
+            found.insert(found.end(), files.begin(), files.end());
+        } catch (error& e) {
+            lock_guard<mutex> lock(foundMutex);
+            if (errorCode == LIBBSA_OK) {
+                errorCode = e.code();
+                errorMessage = e.what();
+            }
+        } catch (fs::filesystem_error& e) {
+            lock_guard<mutex> lock(foundMutex);
+            if (errorCode == LIBBSA_OK) {
+                errorCode = LIBBSA_ERROR_FILESYSTEM_ERROR;
+                errorMessage = e.what();
+            }
+        } catch (bad_alloc& e) {
+            lock_guard<mutex> lock(foundMutex);
+            if (errorCode == LIBBSA_OK) {
+                errorCode = LIBBSA_ERROR_NO_MEM;
+                errorMessage = e.what();
+            }
+        } catch (exception& e) {
+            lock_guard<mutex> lock(foundMutex);
+            if (errorCode == LIBBSA_OK) {
+                errorCode = LIBBSA_ERROR_FILESYSTEM_ERROR;
+                errorMessage = e.what();
+            }
+        } catch (...) {
+            lock_guard<mutex> lock(foundMutex);
+            if (errorCode == LIBBSA_OK) {
+                errorCode = LIBBSA_ERROR_FILESYSTEM_ERROR;
+                errorMessage = "Unknown error.";
+            }
+        }
+    };
+    tasks.Submit([&walk, &sourceDir]() { walk(fs::path(sourceDir), ""); });
+    tasks.Wait();
+
+    if (errorCode != LIBBSA_OK)
+        throw error(errorCode, errorMessage);
+
+    //Sort so that the result doesn't depend on the order the tasks ran in, and so that paths
+    //that only differ in case, which BSAs can't tell apart, are next to each other.
+    sort(found.begin(), found.end(), [](const pair<PendingBsaAsset, BsaAsset>& first, const pair<PendingBsaAsset, BsaAsset>& second) {
+        return first.first.intPath < second.first.intPath;
+    });
+
+    list<PendingBsaAsset> newPending;
+    list<BsaAsset> newIndex;
+    for (size_t i=0, max=found.size(); i < max; i++) {
+        if (i > 0 && found[i].first.intPath == found[i - 1].first.intPath)
+            throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + found[i - 1].first.extPath + "\" and \"" + found[i].first.extPath + "\" have the same path in the BSA.");
+
+        newPending.push_back(found[i].first);
+        newIndex.push_back(found[i].second);
+    }
+
+    assets.swap(newIndex);
+    pendingAssets.swap(newPending);
+    mergedAssets.clear();
+}
+
+void _bsa_handle_int::MergeAssets(const std::vector<_bsa_handle_int*>& sources) {
+    //Find the BSA that each path comes from first, so that only the assets that are kept are indexed.
+    boost::unordered_map<string, pair<_bsa_handle_int*, const BsaAsset*> > found;
+    for (size_t i=0, max=sources.size(); i < max; i++) {
+        if (sources[i] == this)
+            throw error(LIBBSA_ERROR_INVALID_ARGS, "A BSA cannot be merged into itself.");
+        for (list<BsaAsset>::const_iterator it = sources[i]->assets.begin(), endIt = sources[i]->assets.end(); it != endIt; ++it)
+            found[it->path] = make_pair(sources[i], &*it);
+    }
+
+    list<BsaAsset> newIndex;
+    list<PendingBsaAsset> newPending;
+    boost::unordered_map<string, MergedAsset> newMerged;
+    for (boost::unordered_map<string, pair<_bsa_handle_int*, const BsaAsset*> >::const_iterator it = found.begin(), endIt = found.end(); it != endIt; ++it)
+        IndexMergedAsset(*it->second.first, *it->second.second, newIndex, newPending, newMerged);
+
+    assets.swap(newIndex);
+    pendingAssets.swap(newPending);
+    mergedAssets.swap(newMerged);
+}
+
+void _bsa_handle_int::IndexMergedAsset(_bsa_handle_int& source, const BsaAsset& sourceAsset, std::list<BsaAsset>& index, std::list<PendingBsaAsset>& pending, boost::unordered_map<std::string, MergedAsset>& merged) {
+    BsaAsset asset;
+    asset.path = sourceAsset.path;
+    asset.hash = HashPath(asset.path);  //BSA types hash paths differently. Also checks that the path can be encoded.
+    index.push_back(asset);
+
+    //Assets that the source hasn't written yet are read from wherever it would read them from.
+    if (sourceAsset.offset == 0) {
+        boost::unordered_map<string, MergedAsset>::const_iterator mergedIt = source.mergedAssets.find(asset.path);
+        if (mergedIt != source.mergedAssets.end()) {
+            merged.insert(*mergedIt);
+            return;
+        }
+        for (list<PendingBsaAsset>::const_iterator it = source.pendingAssets.begin(), endIt = source.pendingAssets.end(); it != endIt; ++it) {
+            if (it->intPath == asset.path) {
+                pending.push_back(*it);
+                return;
+            }
+        }
+    }
+
+    MergedAsset entry;
+    entry.bsa = &source;
+    entry.asset = sourceAsset;
+    merged.insert(make_pair(asset.path, entry));
+}
+
+void _bsa_handle_int::RemoveAsset(const std::string& assetPath) {
+    list<BsaAsset>::iterator it, endIt;
+    for (it = assets.begin(), endIt = assets.end(); it != endIt; ++it) {
+        if (it->path == assetPath)
+            break;
+    }
+    if (it == endIt)
+        throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + assetPath + "\" is not in the BSA.");
+
+    //Assets that have been written have no pending or merged entry.
+    if (it->offset == 0) {
+        mergedAssets.erase(assetPath);
+        for (list<PendingBsaAsset>::iterator itr = pendingAssets.begin(), endItr = pendingAssets.end(); itr != endItr; ++itr) {
+            if (itr->intPath == assetPath) {
+                pendingAssets.erase(itr);
+                break;
+            }
+        }
+    }
+    assets.erase(it);
+}
+
+void _bsa_handle_int::GetPendingSources(boost::unordered_map<std::string, const std::string*>& sources) const {
+    sources.clear();
+    for (list<PendingBsaAsset>::const_iterator it = pendingAssets.begin(), endIt = pendingAssets.end(); it != endIt; ++it)
+        sources[it->intPath] = &it->extPath;
+}
+
+void _bsa_handle_int::IndexPendingAssets(const std::list<PendingBsaAsset>& newAssets, std::list<BsaAsset>& index) {
+    vector<BsaAsset*> indexed;
+    vector<const string*> paths;
+    for (list<PendingBsaAsset>::const_iterator it = newAssets.begin(), endIt = newAssets.end(); it != endIt; ++it) {
+        try {
+            if (!fs::is_regular_file(it->extPath))
+                throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, "\"" + it->extPath + "\" is not a file.");
+        } catch (fs::filesystem_error& e) {
+            throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
+        }
+
+        BsaAsset asset;
+        asset.path = it->intPath;
+        index.push_back(asset);
+        indexed.push_back(&index.back());
+        paths.push_back(&it->intPath);
+    }
+
+    //The new assets are hashed together, which also checks that their paths can be encoded.
+    vector<uint64_t> hashes;
+    HashPaths(paths, hashes);
+    for (size_t i=0, max=indexed.size(); i < max; i++)
+        indexed[i]->hash = hashes[i];
+}
+
+void _bsa_handle_int::SetCompressionThreshold(const float minSaving) {
+    if (minSaving < 0 || minSaving > 1)
+        throw error(LIBBSA_ERROR_INVALID_ARGS, "The compression threshold must be between 0 and 1.");
+    compressionThreshold = minSaving;
+}
+
+void _bsa_handle_int::SetDeduplication(const bool enable) {
+    deduplicate = enable;
+}
+
+uint64_t _bsa_handle_int::GetDeduplicatedBytes() const {
+    return deduplicatedBytes;
+}
+
+void _bsa_handle_int::SetDataOrder(const DataOrder order) {
+    dataOrder = order;
+    if (order != DATA_ORDER_LIST)
+        dataOrderRanks.clear();
+}
+
+void _bsa_handle_int::SetDataOrder(const std::vector<std::string>& assetPaths) {
+    boost::unordered_map<string, size_t> ranks;
+    for (size_t i=0, max=assetPaths.size(); i < max; i++) {
+        if (!ranks.insert(make_pair(assetPaths[i], i)).second)
+            throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + assetPaths[i] + "\" is given more than once.");
+    }
+
+    dataOrderRanks.swap(ranks);
+    dataOrder = DATA_ORDER_LIST;
+}
+
+void _bsa_handle_int::SetDataAlignment(const uint32_t alignment, const uint32_t minSize) {
+    if (alignment > 1024 * 1024 || (alignment & (alignment - 1)) != 0)
+        throw error(LIBBSA_ERROR_INVALID_ARGS, "The data alignment must be a power of two no greater than 1 MiB.");
+
+    dataAlignment = alignment;
+    alignmentMinSize = minSize;
+}
+
+void _bsa_handle_int::SetDirectReadThreshold(const size_t minSize) {
+    directReadThreshold = minSize;
+}
+
+void _bsa_handle_int::ReadStoredData(libbsa::ifstream& in, const uint64_t offset, uint8_t * buffer, const size_t size) {
+    if (directReadThreshold > 0 && size >= directReadThreshold && ReadFileDirect(filePath, offset, buffer, size))
+        return;
+
+    in.seekg(offset, ios_base::beg);
+    in.read((char*)buffer, size);
+}
+
+//An asset path split into the parts that data orders sort by.
+struct OrderKey {
+    size_t rank;        //For DATA_ORDER_LIST. Unlisted assets all have the same rank, after the listed ones.
+    string extension;   //For DATA_ORDER_EXTENSION.
+    string folder;
+    string filename;
+    size_t record;      //Makes the order total, so that it doesn't depend on the sort.
+};
+
+void _bsa_handle_int::GetDataOrder(const std::vector<const BsaAsset*>& records, std::vector<size_t>& order) const {
+    order.resize(records.size());
+    for (size_t i=0, max=records.size(); i < max; i++)
+        order[i] = i;
+
+    if (dataOrder == DATA_ORDER_HASH)
+        return;
+
+    vector<OrderKey> keys(records.size());
+    for (size_t i=0, max=records.size(); i < max; i++) {
+        const string& path = records[i]->path;
+        OrderKey& key = keys[i];
+        key.record = i;
+
+        size_t pos = path.rfind('\\');
+        if (pos == string::npos)
+            key.filename = path;
+        else {
+            key.folder = path.substr(0, pos);
+            key.filename = path.substr(pos + 1);
+        }
+
+        if (dataOrder == DATA_ORDER_EXTENSION) {
+            pos = key.filename.rfind('.');
+            if (pos != string::npos)
+                key.extension = key.filename.substr(pos);
+        }
+
+        key.rank = dataOrderRanks.size();
+        if (dataOrder == DATA_ORDER_LIST) {
+            boost::unordered_map<string, size_t>::const_iterator it = dataOrderRanks.find(path);
+            if (it != dataOrderRanks.end())
+                key.rank = it->second;
+        }
+    }
+
+    //Fields that don't apply to the order are the same for every asset, so only the relevant ones have an effect.
+    sort(keys.begin(), keys.end(), [](const OrderKey& first, const OrderKey& second) {
+        if (first.rank != second.rank)
+            return first.rank < second.rank;
+        if (first.extension != second.extension)
+            return first.extension < second.extension;
+        if (first.folder != second.folder)
+            return first.folder < second.folder;
+        if (first.filename != second.filename)
+            return first.filename < second.filename;
+        return first.record < second.record;
+    });
+
+    for (size_t i=0, max=keys.size(); i < max; i++)
+        order[i] = keys[i].record;
+}
+
+void _bsa_handle_int::SaveIncremental() {
+    throw error(LIBBSA_ERROR_INVALID_ARGS, "This type of BSA cannot be saved incrementally.");
+}
+
+void _bsa_handle_int::SaveSplit(const std::string& path, const uint32_t version, const uint32_t compression, const uint64_t maxSize, std::vector<std::string>& partPaths) {
+    //BSA offsets are 32-bit, so no BSA can be larger than 4 GiB anyway.
+    const uint64_t budget = (maxSize < UINT32_MAX ? maxSize : UINT32_MAX);
+
+    //Estimate how much space each asset takes up. Stored data is assumed to keep its size, and added assets to be stored uncompressed,
+    //so a BSA can only end up over budget if data is decompressed by the save. Every BSA type's records take up less than estimated.
+    const uint64_t bsaOverhead = 1024;
+    const uint64_t assetOverhead = 64;
+    struct SizedAsset {
+        std::string folder;
+        const BsaAsset * asset;
+        uint64_t size;
+    };
+    boost::unordered_map<string, const string*> pendingSources;
+    GetPendingSources(pendingSources);
+    vector<SizedAsset> sized;
+    sized.reserve(assets.size());
+    for (list<BsaAsset>::const_iterator it = assets.begin(), endIt = assets.end(); it != endIt; ++it) {
+        SizedAsset entry;
+        const size_t pos = it->path.rfind('\\');
+        if (pos != string::npos)
+            entry.folder = it->path.substr(0, pos);
+        entry.asset = &*it;
+
+        boost::unordered_map<string, const string*>::const_iterator pendingIt = pendingSources.find(it->path);
+        boost::unordered_map<string, MergedAsset>::const_iterator mergedIt = mergedAssets.find(it->path);
+        if (pendingIt != pendingSources.end()) {
+            try {
+                entry.size = fs::file_size(*pendingIt->second);
+            } catch (fs::filesystem_error& e) {
+                throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
+            }
+        } else if (mergedIt != mergedAssets.end())
+            entry.size = mergedIt->second.bsa->StoredSize(mergedIt->second.asset);
+        else
+            entry.size = StoredSize(*it);
+        entry.size += assetOverhead + it->path.length() + (dataAlignment > 1 ? dataAlignment : 0);
+
+        if (bsaOverhead + entry.size > budget)
+            throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + it->path + "\" is too large to fit in a BSA of the given size.");
+        sized.push_back(entry);
+    }
+    sort(sized.begin(), sized.end(), [](const SizedAsset& first, const SizedAsset& second) {
+        if (first.folder != second.folder)
+            return first.folder < second.folder;
+        return first.asset->path < second.asset->path;
+    });
+
+    //Fill each BSA with whole folders while they fit, starting a new BSA for a folder that doesn't fit in the current one
+    //but would fit in an empty one. Folders that are too large for any one BSA are split across as many as needed.
+    vector< vector<const BsaAsset*> > parts(1);
+    uint64_t partSize = bsaOverhead;
+    for (size_t i=0, max=sized.size(); i < max;) {
+        size_t folderEnd = i;
+        uint64_t folderSize = 0;
+        for (; folderEnd < max && sized[folderEnd].folder == sized[i].folder; folderEnd++)
+            folderSize += sized[folderEnd].size;
+
+        if (partSize + folderSize > budget && bsaOverhead + folderSize <= budget && !parts.back().empty()) {
+            parts.push_back(vector<const BsaAsset*>());
+            partSize = bsaOverhead;
+        }
+        for (; i < folderEnd; i++) {
+            if (partSize + sized[i].size > budget) {
+                parts.push_back(vector<const BsaAsset*>());
+                partSize = bsaOverhead;
+            }
+            parts.back().push_back(sized[i].asset);
+            partSize += sized[i].size;
+        }
+    }
+
+    //The first BSA is at path, and the rest have their number added to its filename, eg. "Textures1.bsa".
+    vector<string> newPaths(parts.size());
+    const fs::path basePath(path);
+    for (size_t i=0, max=parts.size(); i < max; i++) {
+        if (i == 0)
+            newPaths[i] = path;
+        else
+            newPaths[i] = (basePath.parent_path() / (basePath.stem().string() + to_string((unsigned long long)i) + basePath.extension().string())).string();
+    }
+
+    //Each BSA is saved from its own handle, which copies its assets' data from this one's file, or their external files.
+    //The handles' compression tasks all run on the shared pool, so writing them at once doesn't run more tasks than there are cores.
+    vector<_bsa_handle_int*> handles;
+    try {
+        for (size_t i=0, max=parts.size(); i < max; i++) {
+            handles.push_back(CreateEmpty());
+            _bsa_handle_int& part = *handles.back();
+            part.compressionThreshold = compressionThreshold;
+            part.dataOrder = dataOrder;
+            part.dataOrderRanks = dataOrderRanks;
+            part.deduplicate = deduplicate;
+            part.dataAlignment = dataAlignment;
+            part.alignmentMinSize = alignmentMinSize;
+            part.directReadThreshold = directReadThreshold;
+
+            for (size_t j=0, maxj=parts[i].size(); j < maxj; j++)
+                part.IndexMergedAsset(*this, *parts[i][j], part.assets, part.pendingAssets, part.mergedAssets);
+        }
+
+        //Only a few BSAs are written at a time, as that is enough to keep the workers and the disk busy, and each
+        //writer holds a window of compressed blocks in memory.
+        size_t nextPart = 0;
+        mutex partsMutex;  //Guards nextPart and the error details.
+        unsigned int errorCode = LIBBSA_OK;
+        string errorMessage;
+        auto writeParts = [&]() {
+            while (true) {
+                size_t i;
+                {
+                    lock_guard<mutex> lock(partsMutex);
+                    if (nextPart == handles.size() || errorCode != LIBBSA_OK)
+                        return;
+                    i = nextPart++;
+                }
+
+                unsigned int code = LIBBSA_OK;
+                string message;
+                try {
+                    handles[i]->Save(newPaths[i], version, compression);
+                } catch (error& e) {
+                    code = e.code();
+                    message = e.what();
+                } catch (ios_base::failure& e) {
+                    code = LIBBSA_ERROR_FILESYSTEM_ERROR;
+                    message = e.what();
+                } catch (fs::filesystem_error& e) {
+                    code = LIBBSA_ERROR_FILESYSTEM_ERROR;
+                    message = e.what();
+                } catch (bad_alloc& e) {
+                    code = LIBBSA_ERROR_NO_MEM;
+                    message = e.what();
+                } catch (exception& e) {
+                    code = LIBBSA_ERROR_FILESYSTEM_ERROR;
+                    message = e.what();
+                } catch (...) {
+                    code = LIBBSA_ERROR_FILESYSTEM_ERROR;
+                    message = "Unknown error.";
+                }
+
+                if (code != LIBBSA_OK) {
+                    lock_guard<mutex> lock(partsMutex);
+                    if (errorCode == LIBBSA_OK) {
+                        errorCode = code;
+                        errorMessage = message;
+                    }
+                }
+            }
+        };
+        const size_t numWriters = (handles.size() < 4 ? handles.size() : 4);
+        vector<thread> writers;
+        writers.reserve(numWriters);  //So that adding a started writer can't throw, leaving it unjoined.
+        try {
+            for (size_t i=0; i < numWriters; i++)
+                writers.push_back(thread(writeParts));
+        } catch (system_error&) {
+            //Carry on with the writers that did start, or write the parts on this thread if none did.
+            if (writers.empty())
+                writeParts();
+        }
+        for (size_t i=0, max=writers.size(); i < max; i++)
+            writers[i].join();
+
+        if (errorCode != LIBBSA_OK)
+            throw error(errorCode, errorMessage);
+    } catch (...) {
+        for (size_t i=0, max=handles.size(); i < max; i++)
+            delete handles[i];
+        throw;
+    }
+
+    for (size_t i=0, max=handles.size(); i < max; i++)
+        delete handles[i];
+    partPaths.swap(newPaths);
+}
+
+SaveBlock _bsa_handle_int::PendingBlock(BsaAsset& source, const std::string& extPath, const bool compress, const uint64_t maxSize) {
+    uintmax_t size;
+    try {
+        size = fs::file_size(extPath);
+    } catch (fs::filesystem_error& e) {
+        throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
+    }
+    if (size > maxSize)
+        throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + extPath + "\" is too large to store in a BSA.");
+
+    //Formats that are already compressed are stored uncompressed without trying.
+    SaveBlock block;
+    block.source = &source;
+    block.externalPath = &extPath;
+    block.size = size;
+    block.compress = compress && !IsIncompressibleFormat(source.path);
+    block.transcode = block.compress;
+    return block;
+}
+
+SaveBlock _bsa_handle_int::MergedBlock(BsaAsset& source, const MergedAsset& merged, const int compressionLevel) {
+    //Compressed data can only be copied between BSAs of the same type, as the types use different compression formats.
+    const bool storedCompressed = merged.bsa->IsCompressed(merged.asset);
+    const bool copyable = !storedCompressed || CanCopyStoredDataFrom(*merged.bsa);
+
+    SaveBlock block;
+    block.source = &source;
+    block.merged = &merged;
+    block.size = merged.bsa->StoredSize(merged.asset);
+    if (compressionLevel < 0) {
+        block.compress = storedCompressed;
+        block.transcode = !copyable;
+    } else if (compressionLevel == 0)
+        block.transcode = storedCompressed;
+    else {
+        //Formats that are already compressed are stored uncompressed without trying.
+        block.compress = !IsIncompressibleFormat(source.path);
+        block.transcode = block.compress || storedCompressed;
+    }
+    return block;
+}
+
+void _bsa_handle_int::EncodeData(const uint8_t * /*data*/, const size_t /*size*/, const int /*level*/, std::vector<uint8_t>& /*out*/) {
+    throw error(LIBBSA_ERROR_INVALID_ARGS, "This type of BSA cannot be compressed.");
+}
+
+//Reads size bytes from the start of an external file into memory. Remember to free the memory once used.
+static std::pair<uint8_t*,size_t> ReadExternalFile(const std::string& path, const size_t size) {
+    uint8_t * buffer;
+    try {
+        buffer = new uint8_t[size];
+    } catch (bad_alloc& e) {
+        throw error(LIBBSA_ERROR_NO_MEM, e.what());
+    }
+
+    try {
+        libbsa::ifstream in(fs::path(path), ios::binary);
+        in.exceptions(ios::failbit | ios::badbit | ios::eofbit);  //Causes ifstream::failure to be thrown if problem is encountered.
+
+        in.read((char*)buffer, size);
+        in.close();
+    } catch (...) {
+        delete [] buffer;
+        throw;
+    }
+
+    return pair<uint8_t*,size_t>(buffer, size);
+}
+
+//Identifies stored data by content, for deduplication: a 64-bit FNV-1a hash, and the data's CRC-32 and size.
+//Neither is collision resistant, so data with a matching key must still be compared with the data already written.
+static std::pair<uint64_t, uint64_t> ContentKey(const uint8_t * data, const size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i=0; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+
+    boost::crc_32_type crc;
+    crc.process_bytes(data, size);
+
+    return pair<uint64_t, uint64_t>(hash, ((uint64_t)crc.checksum() << 32) | (uint32_t)size);
+}
+
+void _bsa_handle_int::WriteBlocks(std::ostream& out, const FileHandle outHandle, std::vector<SaveBlock>& blocks, const int compressionLevel) {
+    //Result of transcoding a block on a worker thread.
+    struct Transcoded {
+        Transcoded() : done(false), code(LIBBSA_OK), data(NULL), size(0) {}
+
+        bool done;
+        unsigned int code;
+        std::string message;
+        uint8_t * data;                 //Uncompressed data, if not compressing or if compressing didn't save enough.
+        size_t size;
+        std::vector<uint8_t> encoded;   //Compressed data, if compressing.
+    };
+
+    //A new BSA has no file yet, and all its data comes from external files.
+    libbsa::ifstream in;
+    in.exceptions(ios::failbit | ios::badbit | ios::eofbit);  //Causes ifstream::failure to be thrown if problem is encountered.
+    if (fs::exists(filePath))
+        in.open(fs::path(filePath), ios::binary);
+
+    //Blocks merged from other BSAs are copied from those BSAs' files, which are opened as they are first needed.
+    boost::unordered_map<const _bsa_handle_int*, std::shared_ptr<libbsa::ifstream> > mergedIns;
+    auto sourceIn = [this, &in, &mergedIns](const SaveBlock& block) -> libbsa::ifstream& {
+        if (block.merged == NULL)
+            return in;
+        std::shared_ptr<libbsa::ifstream>& stream = mergedIns[block.merged->bsa];
+        if (!stream) {
+            stream.reset(new libbsa::ifstream(fs::path(block.merged->bsa->filePath), ios::binary));
+            stream->exceptions(ios::failbit | ios::badbit | ios::eofbit);
+        }
+        return *stream;
+    };
+    auto sourceBsa = [](const SaveBlock& block) -> const _bsa_handle_int* {
+        return block.merged == NULL ? NULL : block.merged->bsa;
+    };
+    auto sourceOffset = [](const SaveBlock& block) -> uint64_t {
+        return block.merged == NULL ? block.source->offset : block.merged->asset.offset;
+    };
+
+    //The shared pool is only needed, and so only created, if there is data to transcode.
+    ThreadPool * pool = NULL;
+    for (size_t i=0, max=blocks.size(); i < max && pool == NULL; i++) {
+        if (blocks[i].transcode)
+            pool = &ThreadPool::Shared();
+    }
+    const size_t window = (pool == NULL ? 0 : 2 * pool->Size());  //Enough to keep every worker busy while the writer catches up.
+
+    vector<Transcoded> results(blocks.size());
+    mutex resultsMutex;
+    condition_variable resultDone;
+    size_t pendingTasks = 0;
+
+    size_t nextSubmit = 0;
+    uint64_t offset = out.tellp();
+    vector<uint8_t> buffer(1024 * 1024);  //For copying data that can't be copied directly.
+
+    //Blocks that are large enough to be aligned start at the next multiple of the alignment, with zeros written before them.
+    const vector<uint8_t> padding(dataAlignment > 1 ? dataAlignment : 0);
+    auto alignedOffset = [this](const uint64_t position, const SaveBlock& block) -> uint64_t {
+        if (dataAlignment <= 1 || block.size == 0 || block.size < alignmentMinSize)
+            return position;
+        return (position + dataAlignment - 1) & ~(uint64_t)(dataAlignment - 1);
+    };
+    auto align = [&out, &offset, &padding, &alignedOffset](SaveBlock& block) {
+        const uint64_t start = alignedOffset(offset, block);
+        if (start > offset) {
+            out.write((char*)padding.data(), start - offset);
+            offset = start;
+        }
+        block.offset = offset;
+    };
+
+    //When deduplicating, blocks with the same stored data as an earlier block share its data instead of being written.
+    boost::unordered_map<pair<uint64_t, uint64_t>, uint64_t> writtenData;  //The offset of each distinct stored content.
+    vector<uint8_t> writtenBuffer;  //For reading back written data to compare.
+    deduplicatedBytes = 0;
+    auto isWritten = [&out, outHandle, &offset, &writtenBuffer](const uint64_t writtenOffset, const uint8_t * data, const size_t size) -> bool {
+        out.flush();  //The data is read back from the file, so anything the stream has buffered must be written first.
+        if (writtenBuffer.empty())
+            writtenBuffer.resize(1024 * 1024);
+
+        bool same = true;
+        for (size_t compared = 0, chunk; same && compared < size; compared += chunk) {
+            chunk = (size - compared < writtenBuffer.size() ? size - compared : writtenBuffer.size());
+            ReadFileData(outHandle, writtenOffset + compared, &writtenBuffer[0], chunk);
+            same = (memcmp(&writtenBuffer[0], data + compared, chunk) == 0);
+        }
+        out.seekp(offset, ios_base::beg);
+        return same;
+    };
+    auto writeData = [this, &out, &offset, &writtenData, &align, &isWritten](SaveBlock& block, const uint8_t * data) {
+        pair<uint64_t, uint64_t> key;
+        if (deduplicate && block.size > 0) {
+            key = ContentKey(data, block.size);
+            boost::unordered_map<pair<uint64_t, uint64_t>, uint64_t>::const_iterator it = writtenData.find(key);
+            if (it != writtenData.end() && isWritten(it->second, data, block.size)) {
+                block.offset = it->second;
+                deduplicatedBytes += block.size;
+                return;
+            }
+        }
+
+        align(block);
+        if (deduplicate && block.size > 0)
+            writtenData.insert(make_pair(key, block.offset));
+        out.write((char*)data, block.size);
+        offset += block.size;
+    };
+    try {
+        for (size_t i=0, max=blocks.size(); i < max; i++) {
+            //Keep the workers supplied with blocks ahead of this one.
+            for (size_t limit = (i + window < max ? i + window : max); nextSubmit < limit; nextSubmit++) {
+                if (!blocks[nextSubmit].transcode)
+                    continue;
+
+                {
+                    lock_guard<mutex> lock(resultsMutex);
+                    pendingTasks++;
+                }
+
+                const size_t j = nextSubmit;
+                try {
+                    pool->Submit([this, j, compressionLevel, &blocks, &results, &resultsMutex, &resultDone, &pendingTasks]() {
+                        Transcoded& result = results[j];
+                        try {
+                            pair<uint8_t*,size_t> data;
+                            if (blocks[j].externalPath != NULL)
+                                data = ReadExternalFile(*blocks[j].externalPath, blocks[j].size);
+                            else if (blocks[j].merged != NULL) {
+                                const MergedAsset& merged = *blocks[j].merged;
+                                libbsa::ifstream blockIn(fs::path(merged.bsa->filePath), ios::binary);
+                                blockIn.exceptions(ios::failbit | ios::badbit | ios::eofbit);
+
+                                data = merged.bsa->ReadData(blockIn, merged.asset);
+                            } else {
+                                libbsa::ifstream blockIn(fs::path(filePath), ios::binary);
+                                blockIn.exceptions(ios::failbit | ios::badbit | ios::eofbit);
+
+                                data = ReadData(blockIn, *blocks[j].source);
+                            }
+                            if (blocks[j].compress) {
+                                try {
+                                    EncodeData(data.first, data.second, compressionLevel, result.encoded);
+                                } catch (...) {
+                                    delete [] data.first;
+                                    throw;
+                                }
+
+                                //Data that doesn't compress well enough is stored as-is, so reading it back is a plain copy.
+                                if (result.encoded.size() > data.second * (1 - compressionThreshold)) {
+                                    vector<uint8_t>().swap(result.encoded);
+                                    result.data = data.first;
+                                    result.size = data.second;
+                                } else
+                                    delete [] data.first;
+                            } else {
+                                result.data = data.first;
+                                result.size = data.second;
+                            }
+                        } catch (error& e) {
+                            result.code = e.code();
+                            result.message = e.what();
+                        } catch (ios_base::failure& e) {
+                            result.code = LIBBSA_ERROR_FILESYSTEM_ERROR;
+                            result.message = e.what();
+                        } catch (fs::filesystem_error& e) {
+                            result.code = LIBBSA_ERROR_FILESYSTEM_ERROR;
+                            result.message = e.what();
+                        } catch (bad_alloc& e) {
+                            result.code = LIBBSA_ERROR_NO_MEM;
+                            result.message = e.what();
+                        } catch (exception& e) {
+                            result.code = LIBBSA_ERROR_FILESYSTEM_ERROR;
+                            result.message = e.what();
+                        } catch (...) {
+                            result.code = LIBBSA_ERROR_FILESYSTEM_ERROR;
+                            result.message = "Unknown error.";
+                        }
+
+                        //Always reached, as the writer waits for every task to be done. It is notified with the lock held,
+                        //as it may return and destroy resultDone as soon as it sees that no tasks are pending.
+                        lock_guard<mutex> lock(resultsMutex);
+                        result.done = true;
+                        pendingTasks--;
+                        resultDone.notify_all();
+                    });
+                } catch (...) {
+                    //The task was never queued, so it won't be waited for.
+                    lock_guard<mutex> lock(resultsMutex);
+                    pendingTasks--;
+                    throw;
+                }
+            }
+
+            SaveBlock& block = blocks[i];
+
+            if (!block.transcode && deduplicate) {
+                //The data must be in memory to be compared, so it's read in whole rather than copied directly.
+                libbsa::ifstream externalIn;
+                externalIn.exceptions(ios::failbit | ios::badbit | ios::eofbit);
+                if (block.externalPath != NULL)
+                    externalIn.open(fs::path(*block.externalPath), ios::binary);
+                else if ((uint64_t)sourceIn(block).tellg() != sourceOffset(block))
+                    sourceIn(block).seekg(sourceOffset(block), ios_base::beg);
+
+                if (buffer.size() < block.size)
+                    buffer.resize(block.size);
+                (block.externalPath != NULL ? externalIn : sourceIn(block)).read((char*)&buffer[0], block.size);
+                writeData(block, &buffer[0]);
+            } else if (!block.transcode && block.externalPath != NULL) {
+                libbsa::ifstream externalIn(fs::path(*block.externalPath), ios::binary);
+                externalIn.exceptions(ios::failbit | ios::badbit | ios::eofbit);
+
+                align(block);
+                CopyData(externalIn, 0, out, outHandle, offset, block.size, buffer);
+                offset += block.size;
+            } else if (!block.transcode) {
+                //Unchanged blocks are usually stored contiguously, so copy as long a run of them as possible at once.
+                //A run ends at a block that needs padding before it.
+                align(block);
+                uint64_t length = block.size;
+                while (i + 1 < max && !blocks[i + 1].transcode && blocks[i + 1].externalPath == NULL
+                    && sourceBsa(blocks[i + 1]) == sourceBsa(block)
+                    && sourceOffset(blocks[i + 1]) == sourceOffset(block) + length
+                    && alignedOffset(offset + length, blocks[i + 1]) == offset + length) {
+                    i++;
+                    blocks[i].offset = offset + length;
+                    length += blocks[i].size;
+                }
+
+                CopyData(sourceIn(block), sourceOffset(block), out, outHandle, offset, length, buffer);
+                offset += length;
+            } else {
+                Transcoded& result = results[i];
+                {
+                    unique_lock<mutex> lock(resultsMutex);
+                    while (!result.done)
+                        resultDone.wait(lock);
+                }
+
+                if (result.code != LIBBSA_OK)
+                    throw error(result.code, result.message);
+
+                if (result.data == NULL) {
+                    block.size = result.encoded.size();
+                    writeData(block, result.encoded.data());
+                    vector<uint8_t>().swap(result.encoded);  //Free the memory now rather than at the end.
+                } else {
+                    block.compress = false;
+                    block.size = result.size;
+                    writeData(block, result.data);
+                    delete [] result.data;
+                    result.data = NULL;
+                }
+            }
+        }
+    } catch (...) {
+        //Tasks reference the locals above, so let any running ones finish, then free whatever they produced.
+        {
+            unique_lock<mutex> lock(resultsMutex);
+            while (pendingTasks > 0)
+                resultDone.wait(lock);
+        }
+        for (size_t i=0, max=results.size(); i < max; i++)
+            delete [] results[i].data;
+        throw;
+    }
+
+    if (in.is_open())
+        in.close();
+}
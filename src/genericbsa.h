@@ -26,44 +26,123 @@
 
 #include "helpers.h"
 #include "streams.h"
+#include "fileio.h"
+#include "threadpool.h"
 #include <stdint.h>
 #include <string>
 #include <list>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <functional>
 #include <boost/regex.hpp>
+#include <boost/unordered_map.hpp>
 
 /* This header declares the generic structures that libbsa uses to handle BSA
    manipulation.
    All strings are encoded in UTF-8.
 */
 
+struct _bsa_handle_int;
+
 namespace libbsa {
 
     //Class for generic BSA data.
-    //Files that have not yet been written have 0 hash, size and offset.
+    //Files that have not yet been written have 0 size and offset.
     struct BsaAsset {
         BsaAsset();
 
         //Asset data obtained from BSA.
         std::string path;
         uint64_t hash;
-        uint32_t size;                  //Files that have not yet been written to the BSA file have a size of 0.
-        uint32_t offset;                //This offset is from the beginning of the file - Tes3 BSAs use from the beginning of the data section,
+        uint64_t size;                  //Files that have not yet been written to the BSA file have a size of 0. Some BSA types also store flags in it.
+        uint64_t offset;                //This offset is from the beginning of the file - Tes3 BSAs use from the beginning of the data section,
                                         //so will have to adjust them. Files that have not yet been written to the BSA have a 0 offset.
+                                        //The formats store 32-bit sizes and offsets, so saving checks that they fit.
     };
 
     struct PendingBsaAsset {
         std::string extPath;  //Path of file in filesystem.
         std::string intPath;  //Path of file in BSA.
     };
+
+    //Outcome of an asynchronous extraction request.
+    //For extractions to memory, ownership of data passes to whoever receives the result.
+    struct AsyncResult {
+        AsyncResult();
+
+        uint32_t requestId;
+        unsigned int code;      //A libbsa return code.
+        std::string message;    //Error details, empty on success.
+        uint8_t * data;         //NULL for extractions to file and failed requests.
+        size_t size;
+    };
+
+    //Called on a worker thread once a request completes.
+    typedef std::function<void(const AsyncResult&)> AsyncCallback;
+
+    //An asset whose data is in another BSA, for merging.
+    struct MergedAsset {
+        _bsa_handle_int * bsa;
+        BsaAsset asset;     //The asset as it is in that BSA.
+    };
+
+    //An asset's data block, as written out during a save.
+    struct SaveBlock {
+        SaveBlock();
+
+        BsaAsset * source;  //The asset in the archive being saved.
+        const std::string * externalPath;  //For assets that have not yet been written, the file to read the uncompressed data from. Otherwise NULL.
+        const MergedAsset * merged;  //For assets whose data is in another BSA, where to read it from. Otherwise NULL.
+        bool transcode;     //If false, the stored data is copied unchanged. If true, it is decoded and then re-encoded.
+        bool compress;      //Whether a transcoded block should be compressed. Cleared once written if the data was stored uncompressed.
+                            //For merged blocks that are copied unchanged, whether the copied data is compressed.
+        uint64_t size;      //Stored size of the data, excluding any flags. Set from the source for copied blocks, and updated once written.
+        uint64_t offset;    //Set once written.
+    };
+
+    //The location of an asset's stored data in the BSA file.
+    struct StoredBlock {
+        StoredBlock();
+
+        const BsaAsset * asset;
+        uint64_t offset;
+        uint64_t size;      //Excluding any flags.
+    };
+
+    //The order in which asset data is written when saving. Records are always in the order the BSA type requires.
+    enum DataOrder {
+        DATA_ORDER_HASH,        //The same order as the records.
+        DATA_ORDER_FOLDER,      //By folder path, then by filename.
+        DATA_ORDER_EXTENSION,   //By extension, then by folder path and filename.
+        DATA_ORDER_LIST         //The assets in a given list first, in the order given, then the rest by folder.
+    };
+
+    //The assets found to have bad hashes when verifying a BSA's index.
+    struct HashReport {
+        std::vector<std::string> mismatched;  //Paths of assets whose stored hash, or whose folder's stored hash, doesn't match their path.
+        std::vector<std::string> colliding;   //Paths of assets whose stored hashes are the same as another asset's, so that the games can't tell them apart.
+    };
 }
 
 //Class for generic BSA data manipulation functions.
 struct _bsa_handle_int {
 public:
     _bsa_handle_int(const std::string& path);
-    ~_bsa_handle_int();
+    virtual ~_bsa_handle_int();
     virtual void Save(std::string path, const uint32_t version, const uint32_t compression) = 0;
 
+    //Writes added assets to the end of the BSA file in place, keeping its version and compression, and rewrites its index.
+    //Existing data is only moved if the index grows into it. BSA types that do not support this throw an error.
+    virtual void SaveIncremental();
+
+    //Saves the assets as several BSAs of the handle's type, each estimated to be no larger than maxSize bytes, which are written
+    //in parallel. Assets are grouped by folder, and folders are only split between BSAs if they don't fit in one. The first BSA
+    //is saved at path and the rest are numbered after it, and their paths are output. The handle itself is unchanged.
+    void SaveSplit(const std::string& path, const uint32_t version, const uint32_t compression, const uint64_t maxSize, std::vector<std::string>& partPaths);
+
+    const std::string& GetPath() const;
+
     bool HasAsset(const std::string& assetPath);
     libbsa::BsaAsset GetAsset(const std::string& assetPath);
     void GetMatchingAssets(const boost::regex& regex, std::list<libbsa::BsaAsset>& matchingAssets);
@@ -74,6 +153,52 @@ public:
 
     uint32_t CalcChecksum(const std::string& assetPath);
 
+    //Recomputes the hashes of the assets' paths, as the games do, and reports the assets whose stored hashes don't match or collide.
+    //Large BSAs are hashed on the worker pool. Assets that have been added since the BSA was opened always match.
+    void VerifyHashes(libbsa::HashReport& report);
+
+    //Outputs the stored data of the assets that have been written to the BSA file, in the order it is stored in.
+    void GetStoredBlocks(std::vector<libbsa::StoredBlock>& blocks) const;
+
+    //Assets added to the handle are packed from their external files on the next Save().
+    //They cannot be extracted until then.
+    void AddAsset(const std::string& extPath, const std::string& assetPath);
+    void SetAssets(const std::list<libbsa::PendingBsaAsset>& newAssets);  //Replaces all assets, so all are packed from external files.
+    void SetAssetsFromDirectory(const std::string& sourceDir);  //Replaces all assets with the files under sourceDir, which is walked on the worker pool.
+    //Replaces all assets with those of the given BSAs, with assets in later BSAs replacing those with the same path in earlier ones.
+    //Their stored data is copied from the BSAs on the next Save(), so they must stay open and unchanged until then.
+    void MergeAssets(const std::vector<_bsa_handle_int*>& sources);
+    void RemoveAsset(const std::string& assetPath);
+
+    //Asynchronous extraction. Requests are serviced by the pool of worker threads that all handles share, and return a request ID.
+    //If no callback is given, the result is queued for retrieval with PollCompleted().
+    //The handle must not be modified or destroyed while requests are pending: call WaitForRequests() first.
+    uint32_t ExtractAsync(const std::string& assetPath, const libbsa::AsyncCallback& callback);
+    uint32_t ExtractAsync(const std::string& assetPath, const std::string& destPath, const bool overwrite, const libbsa::AsyncCallback& callback);
+    bool PollCompleted(libbsa::AsyncResult& result);
+    void WaitForRequests();
+
+    //When saving with compression, assets that compress by less than this fraction of their size are stored uncompressed.
+    //0 only stores data uncompressed if compressing it makes it larger. Defaults to 0.05.
+    void SetCompressionThreshold(const float minSaving);
+
+    //When deduplication is enabled, assets whose stored data is identical are saved with a single copy of it that all their records point to.
+    //Disabled by default. GetDeduplicatedBytes() gives how much data the last save didn't write as a result.
+    void SetDeduplication(const bool enable);
+    uint64_t GetDeduplicatedBytes() const;
+
+    //Sets the order asset data is written in by later saves, so that assets that are loaded together can be stored together.
+    void SetDataOrder(const libbsa::DataOrder order);
+    void SetDataOrder(const std::vector<std::string>& assetPaths);  //Uses DATA_ORDER_LIST with the given asset paths.
+
+    //Makes later saves start the stored data of assets at least minSize bytes long at a multiple of alignment bytes, which must be
+    //a power of two no greater than 1 MiB. An alignment of 0 or 1 packs data without gaps, which is the default.
+    void SetDataAlignment(const uint32_t alignment, const uint32_t minSize);
+
+    //Uncompressed assets at least minSize bytes long are read using direct I/O where the platform supports it, bypassing the
+    //OS's file cache, which suits large assets that are read once. 0 disables direct reads, which is the default.
+    void SetDirectReadThreshold(const size_t minSize);
+
     //External data array pointers and sizes.
     char ** extAssets;
     size_t extAssetsNum;
@@ -81,9 +206,84 @@ protected:
     //Reads the asset data into memory, at .first, with size .second. Remember to free the memory once used.
     virtual std::pair<uint8_t*,size_t> ReadData(libbsa::ifstream& in, const libbsa::BsaAsset& data) = 0;
 
+    //Reads size bytes of stored data at offset into buffer, using direct I/O if the data is large enough.
+    void ReadStoredData(libbsa::ifstream& in, const uint64_t offset, uint8_t * buffer, const size_t size);
+
+    //Gets the size of an asset's stored data from its size field, which some BSA types also store flags in.
+    virtual uint64_t StoredSize(const libbsa::BsaAsset& asset) const;
+
+    //Whether an asset's stored data is compressed. BSA types that do not support compression return false.
+    virtual bool IsCompressed(const libbsa::BsaAsset& data) const;
+
+    //Whether compressed data stored by other can be copied into this BSA unchanged, ie. whether both use the same
+    //compression format. BSA types that do not support compression return false.
+    virtual bool CanCopyStoredDataFrom(const _bsa_handle_int& other) const;
+
+    //Creates a handle for a new BSA of the same type, with the same archive flags, and no assets.
+    virtual _bsa_handle_int * CreateEmpty() const = 0;
+
+    //Calculates the hash the BSA type stores for the given asset path.
+    virtual uint64_t HashPath(const std::string& assetPath) = 0;
+    //Calculates the hashes of many asset paths at once, which BSA types can do faster than one at a time.
+    virtual void HashPaths(const std::vector<const std::string*>& assetPaths, std::vector<uint64_t>& hashes);
+
+    //Adds the assets with any other bad hashes to the report, given the paths their hashes were recomputed from.
+    //The default reports assets that share a hash, for BSA types that look assets up by their hash alone.
+    virtual void VerifyIndexHashes(const std::vector<const libbsa::BsaAsset*>& checked, const std::vector<const std::string*>& hashedPaths, libbsa::HashReport& report);
+
+    //Maps the paths of assets that have not yet been written to the external files they will be read from.
+    void GetPendingSources(boost::unordered_map<std::string, const std::string*>& sources) const;
+
     std::string filePath;
     std::list<libbsa::BsaAsset> assets;         //Files not yet written to the BSA are in this and pendingAssets.
     std::list<libbsa::PendingBsaAsset> pendingAssets;  //Holds the internal->external path mapping for files not yet written to the BSA.
+    boost::unordered_map<std::string, libbsa::MergedAsset> mergedAssets;  //Files not yet written to the BSA whose data is in other BSAs, by path.
+
+    //Compresses size bytes at data into the stored form used by the BSA type, replacing the contents of out.
+    //level is from 1 to 9. BSA types that do not support compression throw an error.
+    virtual void EncodeData(const uint8_t * data, const size_t size, const int level, std::vector<uint8_t>& out);
+
+    //Writes the data for each block to out in order, starting at its current position, and sets each block's offset and size.
+    //outHandle is the file that out writes to, which unchanged data is copied to directly, without passing through memory where possible.
+    //Each block to be compressed is trial-compressed, and stored uncompressed if doing so doesn't meet the compression threshold.
+    //When deduplicating, a block whose stored data matches an earlier block's is given that block's offset, and isn't written.
+    //Blocks are padded to the data alignment, if one is set.
+    //Blocks that need transcoding are processed out of order on the worker pool, a bounded number of blocks ahead of the
+    //in-order writer, so compression scales with the number of cores without holding the whole archive in memory.
+    void WriteBlocks(std::ostream& out, const libbsa::FileHandle outHandle, std::vector<libbsa::SaveBlock>& blocks, const int compressionLevel);
+
+    //Creates a block for an asset that has not yet been written, read from extPath. Throws if the file is larger than maxSize.
+    libbsa::SaveBlock PendingBlock(libbsa::BsaAsset& source, const std::string& extPath, const bool compress, const uint64_t maxSize);
+
+    //Creates a block for an asset merged from another BSA. Its stored data is copied unchanged if the compression level
+    //allows it and the BSA types store it the same way, and transcoded otherwise. A negative level keeps the data's compression.
+    libbsa::SaveBlock MergedBlock(libbsa::BsaAsset& source, const libbsa::MergedAsset& merged, const int compressionLevel);
+
+    //Outputs the indices of the given assets, which are in record order, in the order their data should be written.
+    void GetDataOrder(const std::vector<const libbsa::BsaAsset*>& records, std::vector<size_t>& order) const;
+
+    float compressionThreshold;
+    libbsa::DataOrder dataOrder;
+    bool deduplicate;
+    uint64_t deduplicatedBytes;
+    uint32_t dataAlignment;
+    uint32_t alignmentMinSize;
+    size_t directReadThreshold;
+    boost::unordered_map<std::string, size_t> dataOrderRanks;  //Each listed asset's position in the list for DATA_ORDER_LIST.
+private:
+    //Creates an index entry for an asset of another BSA, and the pending or merged entry that its data is written from.
+    void IndexMergedAsset(_bsa_handle_int& source, const libbsa::BsaAsset& sourceAsset, std::list<libbsa::BsaAsset>& index, std::list<libbsa::PendingBsaAsset>& pending,
+        boost::unordered_map<std::string, libbsa::MergedAsset>& merged);
+
+    //Checks that the external files exist, and creates index entries for them.
+    void IndexPendingAssets(const std::list<libbsa::PendingBsaAsset>& newAssets, std::list<libbsa::BsaAsset>& index);
+
+    uint32_t SubmitRequest(const std::function<void(libbsa::AsyncResult&)>& request, const libbsa::AsyncCallback& callback);
+
+    libbsa::TaskGroup requests;  //Pending asynchronous requests.
+    std::mutex asyncMutex;  //Guards the members below.
+    uint32_t lastRequestId;
+    std::deque<libbsa::AsyncResult> completedRequests;
 };
 
 
@@ -0,0 +1,99 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "hashes.h"
+
+#include <stdint.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+using namespace libbsa;
+
+/* Checks that libbsa's hash implementations agree with each other.
+
+   Usage: libbsa-hash-check
+
+   Generated paths of every length up to a few hundred bytes, including bytes
+   above 0x7F, are hashed by the batch, runtime and constexpr versions of each
+   hash, which must all give the same results. The constexpr versions are
+   checked against known hashes when hashes.cpp is compiled, so this ties the
+   faster versions to them. Returns 0 if every check passes.
+*/
+
+int failures = 0;
+
+void Check(const bool passed, const string& description) {
+    cout << (passed ? "PASS " : "FAIL ") << description << endl;
+    if (!passed)
+        failures++;
+}
+
+int main() {
+    //Lengths cover the batch versions' block sizes and the tails around them.
+    const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789_\\\\..\xe9\xff\x80";
+    vector<string> paths;
+    uint32_t seed = 12345;
+    for (size_t length=0; length < 300; length++) {
+        for (size_t k=0; k < 20; k++) {
+            string path;
+            for (size_t j=0; j < length; j++) {
+                seed = seed * 1103515245 + 12345;
+                path += alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+            }
+            paths.push_back(path);
+        }
+    }
+
+    string names;
+    vector<size_t> offsets(1, 0);
+    for (size_t i=0; i < paths.size(); i++) {
+        names += paths[i];
+        offsets.push_back(names.length());
+    }
+
+    vector<uint64_t> tes3Hashes(paths.size()), tes4Hashes(paths.size());
+    Tes3Hashes(names.data(), offsets.data(), paths.size(), tes3Hashes.data());
+    Tes4FileHashes(names.data(), offsets.data(), paths.size(), tes4Hashes.data());
+
+    size_t tes3Mismatches = 0, tes4Mismatches = 0;
+    for (size_t i=0; i < paths.size(); i++) {
+        const char * path = paths[i].data();
+        const size_t length = paths[i].length();
+        if (tes3Hashes[i] != Tes3Hash(path, length) || tes3Hashes[i] != StaticTes3Hash(path, length))
+            tes3Mismatches++;
+        if (tes4Hashes[i] != Tes4FileHash(path, length) || tes4Hashes[i] != StaticTes4FileHash(path, length))
+            tes4Mismatches++;
+    }
+    Check(tes3Mismatches == 0, "TES3 batch, runtime and constexpr hashes agree");
+    Check(tes4Mismatches == 0, "TES4 batch, runtime and constexpr file hashes agree");
+
+    cout << (failures == 0 ? "All checks passed." : "Some checks failed.") << endl;
+    return failures == 0 ? 0 : 1;
+}
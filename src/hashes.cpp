@@ -0,0 +1,284 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+#include "hashes.h"
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define LIBBSA_USE_SSE2
+#endif
+
+using namespace std;
+
+namespace libbsa {
+
+    //The compile-time hashes of known paths, as libbsa's original implementations gave them, so that a change that
+    //breaks them doesn't compile. Non-ASCII TES3 paths hash differently where char is unsigned, so aren't checked.
+    static_assert(StaticTes3Hash("textures\\tx_wood_brown.dds") == 0xF58E98575865632AULL, "TES3 hash is wrong");
+    static_assert(StaticTes3Hash("meshes\\m\\probe_journeyman_01.nif") == 0xBB50069500020336ULL, "TES3 hash is wrong");
+    static_assert(StaticTes3Hash("a") == 0x8000003000000000ULL, "TES3 hash is wrong");
+    static_assert(StaticTes4FileHash("meshes\\clutter\\cup.nif") == 0x92CD45FD6303F570ULL, "TES4 hash is wrong");
+    static_assert(StaticTes4FileHash("sound\\fx\\npc\\bucket\\kick_01.wav") == 0xDDAA878CEB073031ULL, "TES4 hash is wrong");
+    static_assert(StaticTes4FileHash("textures\\clutter\\bucket01_n.dds") == 0xFAEF6952620ADFEEULL, "TES4 hash is wrong");
+    static_assert(StaticTes4FileHash("meshes\\actors\\character\\_male\\idle.kf") == 0x1711E44D69046CE5ULL, "TES4 hash is wrong");
+    static_assert(StaticTes4FileHash("interface\\books\\readme") == 0x321D362872066D65ULL, "TES4 hash is wrong");
+    static_assert(StaticTes4FileHash("caf\xe9.txt") == 0x95D0A723630466E9ULL, "TES4 hash is wrong");
+    static_assert(StaticTes4Hash("meshes\\clutter", 14, "", 0) == 0x8948BE786D0E6572ULL, "TES4 folder hash is wrong");
+
+    static uint32_t Tes3FirstHalf(const char * path, const size_t half) {
+        uint32_t sum = 0;
+        size_t i = 0;
+#ifdef LIBBSA_USE_SSE2
+        //Byte i is xored in at byte position i % 4, so the first half is the xor of its little-endian words,
+        //which can be taken 16 bytes at a time. Where char is signed, each byte above 0x7F also sets the
+        //bits above its position, which are put right afterwards.
+        __m128i sums = _mm_setzero_si128();
+        uint32_t extension = 0;
+        for (; i + 16 <= half; i += 16) {
+            const __m128i bytes = _mm_loadu_si128((const __m128i*)(path + i));
+            sums = _mm_xor_si128(sums, bytes);
+            if (numeric_limits<char>::is_signed) {
+                for (int highBytes = _mm_movemask_epi8(bytes), k = 0; highBytes != 0; highBytes >>= 1, k++) {
+                    if (highBytes & 1)
+                        extension ^= 0xFFFFFF00 << (8 * (k & 3));
+                }
+            }
+        }
+        uint32_t words[4];
+        _mm_storeu_si128((__m128i*)words, sums);
+        sum = words[0] ^ words[1] ^ words[2] ^ words[3] ^ extension;
+#endif
+        for (; i < half; i++)
+            sum ^= (uint32_t)path[i] << ((8 * i) & 0x1F);
+        return sum;
+    }
+
+    //One step of the second half, for the byte off / 8 bytes into it.
+    static inline uint32_t Tes3Step(const uint32_t sum, const char c, const size_t off) {
+        const uint32_t temp = (uint32_t)c << (off & 0x1F);
+        const uint32_t n = temp & 0x1F;
+        const uint32_t value = sum ^ temp;
+        return (value >> n) | (value << ((32 - n) & 0x1F));
+    }
+
+    //Each step of the second half depends on the last, so a single path's can't be split up. Continues
+    //the second half of path from byte i, off / 8 bytes into it, with the given sum.
+    static uint32_t Tes3SecondHalf(const char * path, size_t i, const size_t length, size_t off, uint32_t sum) {
+        for (; i < length; i++, off += 8)
+            sum = Tes3Step(sum, path[i], off);
+        return sum;
+    }
+
+    uint64_t Tes3Hash(const char * path, const size_t length) {
+        const size_t half = length >> 1;
+        return (uint64_t)Tes3FirstHalf(path, half) + ((uint64_t)Tes3SecondHalf(path, half, length, 0, 0) << 32);
+    }
+
+    //Each character multiplies the hash by 0x1003F before being added, so four characters can be added at
+    //once using the powers of 0x1003F, which makes their multiplications independent of each other.
+    static const uint32_t power1 = 0x1003F;
+    static const uint32_t power2 = power1 * power1;
+    static const uint32_t power3 = power2 * power1;
+    static const uint32_t power4 = power3 * power1;
+
+    static inline uint32_t Tes4Step4(const uint32_t hash, const char * str) {
+        return hash * power4
+            + (uint8_t)str[0] * power3
+            + (uint8_t)str[1] * power2
+            + (uint8_t)str[2] * power1
+            + (uint8_t)str[3];
+    }
+
+    //Continues the hash with the given characters.
+    static uint32_t Tes4String(const char * str, const size_t length, uint32_t hash) {
+        size_t i = 0;
+        for (; i + 4 <= length; i += 4)
+            hash = Tes4Step4(hash, str + i);
+        for (; i < length; i++)
+            hash = hash * power1 + (uint8_t)str[i];
+        return hash;
+    }
+
+    static bool Equals(const char * str, const size_t length, const char * literal) {
+        return strlen(literal) == length && memcmp(str, literal, length) == 0;
+    }
+
+    //The low half of the hash, from the ends of the stem, its length and the extension.
+    static uint32_t Tes4Low(const char * stem, const size_t stemLength, const char * ext, const size_t extLength) {
+        uint32_t hash = 0;
+        if (stemLength > 0) {
+            hash = (uint8_t)stem[stemLength - 1]
+                + ((uint32_t)stemLength << 16)
+                + ((uint32_t)(uint8_t)stem[0] << 24);
+            if (stemLength > 2)
+                hash += (uint32_t)(uint8_t)stem[stemLength - 2] << 8;
+        }
+
+        if (Equals(ext, extLength, ".kf"))
+            hash += 0x80;
+        else if (Equals(ext, extLength, ".nif"))
+            hash += 0x8000;
+        else if (Equals(ext, extLength, ".dds"))
+            hash += 0x8080;
+        else if (Equals(ext, extLength, ".wav"))
+            hash += 0x80000000;
+        return hash;
+    }
+
+    //The characters of the stem that the high half hashes: all but its first and last two.
+    static inline size_t Tes4MiddleLength(const size_t stemLength) {
+        return stemLength > 3 ? stemLength - 3 : 0;
+    }
+
+    uint64_t Tes4Hash(const char * stem, const size_t stemLength, const char * ext, const size_t extLength) {
+        const uint32_t hash2 = Tes4String(stem + 1, Tes4MiddleLength(stemLength), 0) + Tes4String(ext, extLength, 0);
+        return ((uint64_t)hash2 << 32) + Tes4Low(stem, stemLength, ext, extLength);
+    }
+
+    //The position after the last c in str from begin to end, or begin if there is none.
+    static size_t AfterLast(const char * str, const size_t begin, size_t end, const char c) {
+#ifdef LIBBSA_USE_SSE2
+        const __m128i needle = _mm_set1_epi8(c);
+        for (; end >= begin + 16; end -= 16) {
+            const int matches = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(str + end - 16)), needle));
+            if (matches != 0) {
+                int last = 15;
+                while (!(matches & (1 << last)))
+                    last--;
+                return end - 16 + last + 1;
+            }
+        }
+#endif
+        while (end > begin && str[end - 1] != c)
+            end--;
+        return end;
+    }
+
+    //Splits a path into its filename's stem and extension, which includes the dot. Only the filename is hashed.
+    static void SplitFilename(const char * path, const size_t length, const char *& stem, size_t& stemLength, const char *& ext, size_t& extLength) {
+        const size_t start = AfterLast(path, 0, length, '\\');
+        size_t dot = AfterLast(path, start, length, '.');
+        if (dot == start)
+            dot = length + 1;  //No extension.
+
+        stem = path + start;
+        stemLength = dot - 1 - start;
+        ext = path + dot - 1;
+        extLength = length + 1 - dot;
+    }
+
+    uint64_t Tes4FileHash(const char * path, const size_t length) {
+        const char * stem;
+        const char * ext;
+        size_t stemLength, extLength;
+        SplitFilename(path, length, stem, stemLength, ext, extLength);
+        return Tes4Hash(stem, stemLength, ext, extLength);
+    }
+
+    /* The batch versions hash four paths at a time, stepping through their dependency chains together, so
+       that each path's multiplications or rotations run while the others' are waiting on their results.
+       Once the shortest of the four is done, the rest are finished one at a time. */
+
+    void Tes3Hashes(const char * names, const size_t * offsets, const size_t count, uint64_t * hashes) {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            const char * path[4];
+            size_t start[4], length[4];
+            uint32_t low[4], high[4];
+            size_t common = numeric_limits<size_t>::max();
+            for (int k=0; k < 4; k++) {
+                path[k] = names + offsets[i + k];
+                length[k] = offsets[i + k + 1] - offsets[i + k];
+                start[k] = length[k] >> 1;
+                low[k] = Tes3FirstHalf(path[k], start[k]);
+                high[k] = 0;
+                if (length[k] - start[k] < common)
+                    common = length[k] - start[k];
+            }
+
+            for (size_t j=0; j < common; j++) {
+                high[0] = Tes3Step(high[0], path[0][start[0] + j], 8 * j);
+                high[1] = Tes3Step(high[1], path[1][start[1] + j], 8 * j);
+                high[2] = Tes3Step(high[2], path[2][start[2] + j], 8 * j);
+                high[3] = Tes3Step(high[3], path[3][start[3] + j], 8 * j);
+            }
+
+            for (int k=0; k < 4; k++) {
+                high[k] = Tes3SecondHalf(path[k], start[k] + common, length[k], 8 * common, high[k]);
+                hashes[i + k] = (uint64_t)low[k] + ((uint64_t)high[k] << 32);
+            }
+        }
+        for (; i < count; i++)
+            hashes[i] = Tes3Hash(names + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+
+    //Hashes four strings together.
+    static void Tes4Strings(const char * const str[4], const size_t length[4], uint32_t hash[4]) {
+        size_t common = length[0];
+        for (int k=1; k < 4; k++) {
+            if (length[k] < common)
+                common = length[k];
+        }
+
+        uint32_t h0 = 0, h1 = 0, h2 = 0, h3 = 0;
+        size_t j = 0;
+        for (; j + 4 <= common; j += 4) {
+            h0 = Tes4Step4(h0, str[0] + j);
+            h1 = Tes4Step4(h1, str[1] + j);
+            h2 = Tes4Step4(h2, str[2] + j);
+            h3 = Tes4Step4(h3, str[3] + j);
+        }
+        hash[0] = Tes4String(str[0] + j, length[0] - j, h0);
+        hash[1] = Tes4String(str[1] + j, length[1] - j, h1);
+        hash[2] = Tes4String(str[2] + j, length[2] - j, h2);
+        hash[3] = Tes4String(str[3] + j, length[3] - j, h3);
+    }
+
+    void Tes4FileHashes(const char * names, const size_t * offsets, const size_t count, uint64_t * hashes) {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            const char * stem[4];
+            const char * middle[4];
+            const char * ext[4];
+            size_t stemLength[4], middleLength[4], extLength[4];
+            for (int k=0; k < 4; k++) {
+                SplitFilename(names + offsets[i + k], offsets[i + k + 1] - offsets[i + k], stem[k], stemLength[k], ext[k], extLength[k]);
+                middle[k] = stem[k] + 1;
+                middleLength[k] = Tes4MiddleLength(stemLength[k]);
+            }
+
+            uint32_t middleHashes[4], extHashes[4];
+            Tes4Strings(middle, middleLength, middleHashes);
+            Tes4Strings(ext, extLength, extHashes);
+
+            for (int k=0; k < 4; k++) {
+                const uint32_t hash2 = middleHashes[k] + extHashes[k];
+                hashes[i + k] = ((uint64_t)hash2 << 32) + Tes4Low(stem[k], stemLength[k], ext[k], extLength[k]);
+            }
+        }
+        for (; i < count; i++)
+            hashes[i] = Tes4FileHash(names + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+}
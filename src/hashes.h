@@ -0,0 +1,142 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __LIBBSA_HASHES_H__
+#define __LIBBSA_HASHES_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The name hashes that BSAs store, for lowercase, backslash-separated
+   Windows-1252 paths.
+
+   Each hash has a constexpr version, so that the hashes of known paths can be
+   computed at compile time, eg. StaticTes4FileHash("meshes\\clutter\\cup.nif"),
+   and a runtime version that gives the same results faster. The batch
+   versions hash many paths at once, which is faster still.
+*/
+
+namespace libbsa {
+
+    namespace detail {
+        //Morrowind hashes the first half of the path by xoring its bytes in at successive byte positions.
+        //Bytes are converted using (unsigned)path[i], like the games, so they are sign-extended where char is signed.
+        constexpr uint32_t Tes3FirstHalf(const char * path, const size_t i, const size_t half, const uint32_t sum) {
+            return i == half ? sum : Tes3FirstHalf(path, i + 1, half, sum ^ ((uint32_t)path[i] << ((8 * i) & 0x1F)));
+        }
+
+        constexpr uint32_t RotateRight(const uint32_t value, const uint32_t n) {
+            return n == 0 ? value : (value >> n) | (value << (32 - n));
+        }
+
+        //The second half also rotates the sum after each byte, by the low bits of the byte's shifted value.
+        constexpr uint32_t Tes3SecondHalf(const char * path, const size_t i, const size_t length, const uint32_t off, const uint32_t sum) {
+            return i == length ? sum : Tes3SecondHalf(path, i + 1, length, off + 8,
+                RotateRight(sum ^ ((uint32_t)path[i] << (off & 0x1F)), ((uint32_t)path[i] << (off & 0x1F)) & 0x1F));
+        }
+
+        constexpr uint32_t Tes4String(const char * str, const size_t length, const uint32_t hash) {
+            return length == 0 ? hash : Tes4String(str + 1, length - 1, 0x1003F * hash + (uint8_t)str[0]);
+        }
+
+        constexpr bool Equals(const char * str, const size_t length, const char * literal) {
+            return length == 0 ? *literal == '\0' : *literal == str[0] && Equals(str + 1, length - 1, literal + 1);
+        }
+
+        constexpr uint32_t Tes4ExtensionBits(const char * ext, const size_t length) {
+            return Equals(ext, length, ".kf") ? 0x80
+                : Equals(ext, length, ".nif") ? 0x8000
+                : Equals(ext, length, ".dds") ? 0x8080
+                : Equals(ext, length, ".wav") ? 0x80000000
+                : 0;
+        }
+
+        //The first, last, second-to-last characters and the length.
+        constexpr uint32_t Tes4Ends(const char * stem, const size_t length) {
+            return length == 0 ? 0 :
+                (uint8_t)stem[length - 1]
+                + ((uint32_t)length << 16)
+                + ((uint32_t)(uint8_t)stem[0] << 24)
+                + (length > 2 ? (uint32_t)(uint8_t)stem[length - 2] << 8 : 0);
+        }
+
+        //The length of the path up to and including its last backslash.
+        constexpr size_t FolderLength(const char * path, const size_t length) {
+            return length == 0 || path[length - 1] == '\\' ? length : FolderLength(path, length - 1);
+        }
+
+        //The position of the filename's last dot, or its length if it has none.
+        constexpr size_t ExtensionStart(const char * filename, const size_t length, const size_t i) {
+            return i == 0 ? length : filename[i - 1] == '.' ? i - 1 : ExtensionStart(filename, length, i - 1);
+        }
+    }
+
+    //Morrowind's hash of a whole path.
+    constexpr uint64_t StaticTes3Hash(const char * path, const size_t length) {
+        return (uint64_t)detail::Tes3FirstHalf(path, 0, length >> 1, 0)
+            + ((uint64_t)detail::Tes3SecondHalf(path, length >> 1, length, 0, 0) << 32);
+    }
+
+    //The hash of a filename split into its stem and extension, which includes the dot, or of a folder path with no extension.
+    constexpr uint64_t StaticTes4Hash(const char * stem, const size_t stemLength, const char * ext, const size_t extLength) {
+        return ((uint64_t)(uint32_t)((stemLength > 3 ? detail::Tes4String(stem + 1, stemLength - 3, 0) : 0) + detail::Tes4String(ext, extLength, 0)) << 32)
+            + (uint32_t)(detail::Tes4Ends(stem, stemLength) + detail::Tes4ExtensionBits(ext, extLength));
+    }
+
+    namespace detail {
+        constexpr uint64_t Tes4FilenameHash(const char * filename, const size_t length, const size_t extStart) {
+            return StaticTes4Hash(filename, extStart, filename + extStart, length - extStart);
+        }
+
+        constexpr uint64_t Tes4FilenameHash(const char * filename, const size_t length) {
+            return Tes4FilenameHash(filename, length, ExtensionStart(filename, length, length));
+        }
+    }
+
+    //The hash of a file's path, of which only the filename is hashed.
+    constexpr uint64_t StaticTes4FileHash(const char * path, const size_t length) {
+        return detail::Tes4FilenameHash(path + detail::FolderLength(path, length), length - detail::FolderLength(path, length));
+    }
+
+    template<size_t N>
+    constexpr uint64_t StaticTes3Hash(const char (&path)[N]) {
+        return StaticTes3Hash(path, N - 1);
+    }
+
+    template<size_t N>
+    constexpr uint64_t StaticTes4FileHash(const char (&path)[N]) {
+        return StaticTes4FileHash(path, N - 1);
+    }
+
+    //Runtime versions of the above.
+    uint64_t Tes3Hash(const char * path, const size_t length);
+    uint64_t Tes4Hash(const char * stem, const size_t stemLength, const char * ext, const size_t extLength);
+    uint64_t Tes4FileHash(const char * path, const size_t length);
+
+    //Batch versions, which hash count paths packed one after another into names, path i being the bytes from
+    //offsets[i] to offsets[i + 1], into hashes. They are faster than hashing the paths one at a time.
+    void Tes3Hashes(const char * names, const size_t * offsets, const size_t count, uint64_t * hashes);
+    void Tes4FileHashes(const char * names, const size_t * offsets, const size_t count, uint64_t * hashes);
+}
+
+#endif
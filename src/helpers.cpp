@@ -33,11 +33,16 @@
 #include "error.h"
 #include "streams.h"
 #include <sstream>
+#include <cstring>
 #include <boost/algorithm/string.hpp>
 #include <boost/crc.hpp>
-#include <boost/locale.hpp>
 #include <boost/filesystem.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define LIBBSA_USE_SSE2
+#endif
+
 using namespace std;
 
 namespace fs = boost::filesystem;
@@ -50,19 +55,75 @@ namespace libbsa {
         return strcpy(p, str.c_str());
     }
 
-    //Replaces all forwardslashes with backslashes, and lowercases letters.
-    string FixPath(const char * path) {
-        string out = string(reinterpret_cast<const char*>(path));
-        boost::to_lower(out);
+    size_t FixPath(const char * path, size_t length, char * out) {
+        if (length > 0 && (path[0] == '/' || path[0] == '\\')) {
+            path++;
+            length--;
+        }
 
-        boost::replace_all(out, "/", "\\");
+        size_t i = 0;
+#ifdef LIBBSA_USE_SSE2
+        //Fold 16 characters at a time. Bytes with their high bit set compare as negative, so are never taken for capitals.
+        const __m128i beforeA = _mm_set1_epi8('A' - 1);
+        const __m128i afterZ = _mm_set1_epi8('Z' + 1);
+        const __m128i caseBit = _mm_set1_epi8(0x20);
+        const __m128i slash = _mm_set1_epi8('/');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        for (; i + 16 <= length; i += 16) {
+            __m128i chars = _mm_loadu_si128((const __m128i*)(path + i));
+            const __m128i capitals = _mm_and_si128(_mm_cmpgt_epi8(chars, beforeA), _mm_cmplt_epi8(chars, afterZ));
+            chars = _mm_or_si128(chars, _mm_and_si128(capitals, caseBit));
+            const __m128i slashes = _mm_cmpeq_epi8(chars, slash);
+            chars = _mm_or_si128(_mm_andnot_si128(slashes, chars), _mm_and_si128(slashes, backslash));
+            _mm_storeu_si128((__m128i*)(out + i), chars);
+        }
+#endif
+        for (; i < length; i++) {
+            const char c = path[i];
+            if (c >= 'A' && c <= 'Z')
+                out[i] = c + ('a' - 'A');
+            else if (c == '/')
+                out[i] = '\\';
+            else
+                out[i] = c;
+        }
+        return length;
+    }
 
-        if (out[0] == '\\')
-            out = out.substr(1);
+    void FixPath(const char * path, std::string& out) {
+        const size_t length = strlen(path);
+        out.resize(length);
+        out.resize(FixPath(path, length, &out[0]));
+    }
 
+    string FixPath(const char * path) {
+        string out;
+        FixPath(path, out);
         return out;
     }
 
+    int CompressionLevel(const uint32_t compression) {
+        if (compression == LIBBSA_COMPRESS_LEVEL_NOCHANGE)
+            return -1;
+
+        //The level flags are consecutive bits, starting with level 0.
+        int level = 0;
+        for (uint32_t flag = LIBBSA_COMPRESS_LEVEL_0; flag != compression && level < 9; flag <<= 1)
+            level++;
+        return level;
+    }
+
+    bool IsIncompressibleFormat(const std::string& path) {
+        //Audio formats: Vorbis, Fuz (lip sync + xWMA), xWMA and MP3.
+        static const char * const extensions[] = { ".ogg", ".fuz", ".xwm", ".mp3" };
+
+        for (size_t i=0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+            if (boost::iends_with(path, extensions[i]))
+                return true;
+        }
+        return false;
+    }
+
     //Calculate the CRC of the given file for comparison purposes.
     uint32_t GetCrc32(const string& filename) {
         uint32_t chksum = 0;
@@ -80,19 +141,108 @@ namespace libbsa {
         return chksum;
     }
 
+    //The Unicode code points of Windows-1252's bytes 0x80 to 0x9F, with 0 for the five bytes that are undefined.
+    //All other bytes have the same values as their code points.
+    static const uint16_t windows1252Specials[32] = {
+        0x20AC, 0, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021, 0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0, 0x017D, 0,
+        0, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014, 0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0, 0x017E, 0x0178
+    };
+
+    //Gives the length of the run of ASCII characters at the start of str, checking 16 bytes at a time where possible.
+    static size_t AsciiLength(const char * str, const size_t length) {
+        size_t i = 0;
+#ifdef LIBBSA_USE_SSE2
+        for (; i + 16 <= length; i += 16) {
+            if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(str + i))) != 0)
+                break;  //The bytes with their high bit set are found below.
+        }
+#endif
+        while (i < length && (uint8_t)str[i] < 0x80)
+            i++;
+        return i;
+    }
+
     std::string ToUTF8(const std::string& str) {
-        try {
-            return boost::locale::conv::to_utf<char>(str, "Windows-1252", boost::locale::conv::stop);
-        } catch (boost::locale::conv::conversion_error& e) {
-            throw error(LIBBSA_ERROR_BAD_STRING, "\"" + str + "\" cannot be encoded in Windows-1252.");
+        //ASCII is the same in both encodings, and almost all names are ASCII.
+        const size_t asciiLength = AsciiLength(str.data(), str.length());
+        if (asciiLength == str.length())
+            return str;
+
+        string out(str, 0, asciiLength);
+        out.reserve(str.length() + 2 * (str.length() - asciiLength));
+        for (size_t i=asciiLength, max=str.length(); i < max; i++) {
+            uint32_t codePoint = (uint8_t)str[i];
+            if (codePoint < 0x80) {
+                out += str[i];
+                continue;
+            } else if (codePoint < 0xA0) {
+                codePoint = windows1252Specials[codePoint - 0x80];
+                if (codePoint == 0)
+                    throw error(LIBBSA_ERROR_BAD_STRING, "\"" + str + "\" cannot be encoded in Windows-1252.");
+            }
+
+            //The code points are all below 0x10000, so take two or three bytes.
+            if (codePoint < 0x800)
+                out += (char)(0xC0 | (codePoint >> 6));
+            else {
+                out += (char)(0xE0 | (codePoint >> 12));
+                out += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+            }
+            out += (char)(0x80 | (codePoint & 0x3F));
         }
+        return out;
     }
 
-    std::string FromUTF8(const std::string& str) {
-        try {
-            return boost::locale::conv::from_utf<char>(str, "Windows-1252", boost::locale::conv::stop);
-        } catch (boost::locale::conv::conversion_error& e) {
-            throw error(LIBBSA_ERROR_BAD_STRING, "\"" + str + "\" cannot be encoded in Windows-1252.");
+    void FromUTF8(const std::string& str, std::string& out) {
+        const size_t asciiLength = AsciiLength(str.data(), str.length());
+        out.assign(str, 0, asciiLength);
+        for (size_t i=asciiLength, max=str.length(); i < max;) {
+            const uint8_t lead = str[i];
+            if (lead < 0x80) {
+                out += str[i];
+                i++;
+                continue;
+            }
+
+            //Windows-1252 only has code points below 0x10000, which take at most three bytes.
+            //Anything else, including overlong and truncated sequences, can't be encoded.
+            uint32_t codePoint = 0;
+            size_t length = 0;
+            if (lead >= 0xC2 && lead < 0xE0) {
+                codePoint = lead & 0x1F;
+                length = 2;
+            } else if (lead >= 0xE0 && lead < 0xF0) {
+                codePoint = lead & 0x0F;
+                length = 3;
+            }
+            if (length == 0 || i + length > max)
+                throw error(LIBBSA_ERROR_BAD_STRING, "\"" + str + "\" cannot be encoded in Windows-1252.");
+            for (size_t j=1; j < length; j++) {
+                const uint8_t c = str[i + j];
+                if ((c & 0xC0) != 0x80)
+                    throw error(LIBBSA_ERROR_BAD_STRING, "\"" + str + "\" cannot be encoded in Windows-1252.");
+                codePoint = (codePoint << 6) | (c & 0x3F);
+            }
+            i += length;
+            if (length == 3 && codePoint < 0x800)
+                throw error(LIBBSA_ERROR_BAD_STRING, "\"" + str + "\" cannot be encoded in Windows-1252.");
+
+            if (codePoint >= 0xA0 && codePoint < 0x100) {
+                out += (char)codePoint;
+                continue;
+            }
+            size_t k = 0;
+            while (k < 32 && (windows1252Specials[k] != codePoint || codePoint == 0))
+                k++;
+            if (k == 32)
+                throw error(LIBBSA_ERROR_BAD_STRING, "\"" + str + "\" cannot be encoded in Windows-1252.");
+            out += (char)(0x80 + k);
         }
     }
+
+    std::string FromUTF8(const std::string& str) {
+        string out;
+        FromUTF8(str, out);
+        return out;
+    }
 }
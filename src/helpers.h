@@ -31,14 +31,25 @@ namespace libbsa {
     // std::string to null-terminated uint8_t string converter.
     char * ToNewCString(const std::string& str);
 
-    //Replaces all forwardslashes with backslashes, and lowercases letters.
+    //Replaces all forwardslashes with backslashes, lowercases letters and removes any leading slash.
+    //Only ASCII letters are lowercased. Writes the length characters of path to out,
+    //which must have room for them and may be path, and returns the number written. Doesn't allocate.
+    size_t FixPath(const char * path, size_t length, char * out);
+    void FixPath(const char * path, std::string& out);  //Reuses out's storage.
     std::string FixPath(const char * path);
 
     uint32_t GetCrc32(const std::string& filename);
 
+    //Converts a single LIBBSA_COMPRESS_LEVEL_* flag to its level, from 0 to 9, or -1 for LIBBSA_COMPRESS_LEVEL_NOCHANGE.
+    int CompressionLevel(const uint32_t compression);
+
+    //Checks if the asset at the given path is in a format that is already compressed, so that compressing it again is wasted effort.
+    bool IsIncompressibleFormat(const std::string& path);
+
     //Only ever need to convert between Windows-1252 and UTF-8.
     std::string ToUTF8(const std::string& str);
     std::string FromUTF8(const std::string& str);
+    void FromUTF8(const std::string& str, std::string& out);  //Reuses out's storage, which must not be str's.
 }
 
 #endif
@@ -27,10 +27,14 @@
 #include "genericbsa.h"
 #include "tes3bsa.h"
 #include "tes4bsa.h"
+#include "ssebsa.h"
+#include "patch.h"
 #include "error.h"
+#include "threadpool.h"
 #include <boost/filesystem/detail/utf8_codecvt_facet.hpp>
 #include <boost/filesystem.hpp>
 #include <locale>
+#include <system_error>
 #include <boost/regex.hpp>
 #include <boost/unordered_set.hpp>
 #include <boost/crc.hpp>
@@ -68,7 +72,7 @@ const unsigned int LIBBSA_RETURN_MAX                = LIBBSA_ERROR_PARSE_FAIL;
 const unsigned int LIBBSA_VERSION_TES3              = 0x00000001;
 const unsigned int LIBBSA_VERSION_TES4              = 0x00000002;
 const unsigned int LIBBSA_VERSION_TES5              = 0x00000004;
-const unsigned int LIBBSA_VERSION_SSE				= 0x00000005;
+const unsigned int LIBBSA_VERSION_SSE               = 0x00000008;
 /* Use only one compression flag. */
 const unsigned int LIBBSA_COMPRESS_LEVEL_0          = 0x00000010;
 const unsigned int LIBBSA_COMPRESS_LEVEL_1          = 0x00000020;
@@ -81,12 +85,94 @@ const unsigned int LIBBSA_COMPRESS_LEVEL_7          = 0x00000800;
 const unsigned int LIBBSA_COMPRESS_LEVEL_8          = 0x00001000;
 const unsigned int LIBBSA_COMPRESS_LEVEL_9          = 0x00002000;
 const unsigned int LIBBSA_COMPRESS_LEVEL_NOCHANGE   = 0x00004000;
+/* Data order flags. */
+const unsigned int LIBBSA_DATA_ORDER_HASH           = 0;
+const unsigned int LIBBSA_DATA_ORDER_FOLDER         = 1;
+const unsigned int LIBBSA_DATA_ORDER_EXTENSION      = 2;
 
 unsigned int c_error(const unsigned int code, const char * what) {
     extErrorString = what;
     return code;
 }
 
+/* Converts the exception being handled into a return code. It may come from
+   the standard library or Boost rather than libbsa, eg. if a thread can't be
+   created, so nothing is thrown past the C interface. */
+unsigned int c_error_from_exception() {
+    try {
+        throw;
+    } catch (error& e) {
+        return c_error(e.code(), e.what());
+    } catch (ios_base::failure& e) {
+        return c_error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
+    } catch (boost::filesystem::filesystem_error& e) {
+        return c_error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
+    } catch (bad_alloc& e) {
+        return c_error(LIBBSA_ERROR_NO_MEM, e.what());
+    } catch (system_error& e) {
+        return c_error(LIBBSA_ERROR_NO_MEM, e.what());  //Worker threads could not be created.
+    } catch (exception& e) {
+        return c_error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
+    } catch (...) {
+        return c_error(LIBBSA_ERROR_FILESYSTEM_ERROR, "Unknown error.");
+    }
+}
+
+
+/* Splits save flags into their version and compression flags, checking that
+   exactly one of each is given and that they are compatible. */
+unsigned int ParseSaveFlags(const unsigned int flags, unsigned int& version, unsigned int& compression) {
+    version = 0;
+
+    //First we need to see what flags are set.
+    if (flags & LIBBSA_VERSION_TES3 && !(flags & LIBBSA_COMPRESS_LEVEL_0))
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Morrowind BSAs cannot be compressed.");
+
+    //Check for version flag duplication.
+    if (flags & LIBBSA_VERSION_TES3)
+        version = LIBBSA_VERSION_TES3;
+    if (flags & LIBBSA_VERSION_TES4) {
+        if (version > 0)
+            return c_error(LIBBSA_ERROR_INVALID_ARGS, "Cannot specify more than one version.");
+        version = LIBBSA_VERSION_TES4;
+    }
+    if (flags & LIBBSA_VERSION_TES5) {
+        if (version > 0)
+            return c_error(LIBBSA_ERROR_INVALID_ARGS, "Cannot specify more than one version.");
+        version = LIBBSA_VERSION_TES5;
+    }
+	if (flags & LIBBSA_VERSION_SSE) {
+		if (version > 0)
+			return c_error(LIBBSA_ERROR_INVALID_ARGS, "Cannot specify more than one version.");
+		version = LIBBSA_VERSION_SSE;
+	}
+
+    //Now remove version flag from flags and check for compression flag duplication.
+    compression = flags ^ version;
+    if (compression == 0 || (compression & (compression-1)))
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Invalid compression level specified.");
+
+    return LIBBSA_OK;
+}
+
+/* Normalises assetPath into storage that the calling thread reuses, so that
+   looking up an asset doesn't allocate once the storage is large enough. */
+const string& FixPathBuffered(const char * assetPath) {
+    static thread_local string buffer;
+    FixPath(assetPath, buffer);
+    return buffer;
+}
+
+/* Imbues paths with a UTF-8 conversion facet, so that UTF-8 paths are
+   handled correctly on all platforms. */
+void ImbueUTF8Paths() {
+    //Set the locale to get encoding conversions working correctly.
+    setlocale(LC_CTYPE, "");
+    locale global_loc = locale();
+    locale loc(global_loc, new boost::filesystem::detail::utf8_codecvt_facet());
+    boost::filesystem::path::imbue(loc);
+}
+
 
 /*------------------------------
    Version Functions
@@ -138,16 +224,14 @@ LIBBSA unsigned int bsa_open (bsa_handle * const bh, const char * const path) {
     if (bh == NULL || path == NULL)  //Check for valid args.
         return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
 
-    //Set the locale to get encoding conversions working correctly.
-    setlocale(LC_CTYPE, "");
-    locale global_loc = locale();
-    locale loc(global_loc, new boost::filesystem::detail::utf8_codecvt_facet());
-    boost::filesystem::path::imbue(loc);
+    ImbueUTF8Paths();
 
     //Create handle for the appropriate BSA type.
     try {
         if (tes3::IsBSA(path))
             *bh = new tes3::BSA(path);
+        else if (sse::IsBSA(path))  //Must come first, as tes4::IsBSA() only checks the magic, which SSE BSAs share.
+            *bh = new sse::BSA(path);
         else if (tes4::IsBSA(path))
             *bh = new tes4::BSA(path);
         else
@@ -161,6 +245,110 @@ LIBBSA unsigned int bsa_open (bsa_handle * const bh, const char * const path) {
     return LIBBSA_OK;
 }
 
+/* Opens a BSA file at path, returning a handle if the hashes stored for its
+   assets match their paths and don't collide. */
+LIBBSA unsigned int bsa_open_verified (bsa_handle * const bh, const char * const path) {
+    if (bh == NULL || path == NULL)  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    bsa_handle handle;
+    unsigned int ret = bsa_open(&handle, path);
+    if (ret != LIBBSA_OK)
+        return ret;
+
+    try {
+        HashReport report;
+        handle->VerifyHashes(report);
+
+        if (!report.mismatched.empty())
+            throw error(LIBBSA_ERROR_PARSE_FAIL, to_string((unsigned long long)report.mismatched.size()) + " assets in \"" + path + "\" have hashes that don't match their paths, starting with \"" + report.mismatched.front() + "\".");
+        else if (!report.colliding.empty())
+            throw error(LIBBSA_ERROR_PARSE_FAIL, to_string((unsigned long long)report.colliding.size()) + " assets in \"" + path + "\" have colliding hashes, starting with \"" + report.colliding.front() + "\".");
+    } catch (...) {
+        bsa_close(handle);
+        return c_error_from_exception();
+    }
+
+    *bh = handle;
+
+    return LIBBSA_OK;
+}
+
+/* Creates a BSA at path from the files in sourcePath and its subdirectories,
+   outputting a handle for it. */
+LIBBSA unsigned int bsa_create_from_directory (bsa_handle * const bh, const char * const sourcePath, const char * const path, const unsigned int flags) {
+    if (bh == NULL || sourcePath == NULL || path == NULL)  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    unsigned int version, compression;
+    unsigned int ret = ParseSaveFlags(flags, version, compression);
+    if (ret != LIBBSA_OK)
+        return ret;
+
+    ImbueUTF8Paths();
+
+    //The handle starts out empty, whatever is at path, and gets the BSA type for the version.
+    _bsa_handle_int * handle = NULL;
+    try {
+        if (version == LIBBSA_VERSION_TES3)
+            handle = new tes3::BSA("");
+        else if (version == LIBBSA_VERSION_SSE)
+            handle = new sse::BSA("");
+        else
+            handle = new tes4::BSA("");
+
+        handle->SetAssetsFromDirectory(sourcePath);
+        handle->Save(path, version, compression);
+    } catch (...) {
+        delete handle;
+        return c_error_from_exception();
+    }
+
+    *bh = handle;
+
+    return LIBBSA_OK;
+}
+
+/* Creates a BSA at path from the assets of the given BSAs, with later BSAs'
+   assets replacing earlier ones with the same path, outputting a handle for it. */
+LIBBSA unsigned int bsa_merge (bsa_handle * const bh, const bsa_handle * const sources, const size_t numSources, const char * const path, const unsigned int flags) {
+    if (bh == NULL || (sources == NULL && numSources > 0) || path == NULL)  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+    for (size_t i=0; i < numSources; i++) {
+        if (sources[i] == NULL)
+            return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+    }
+
+    unsigned int version, compression;
+    unsigned int ret = ParseSaveFlags(flags, version, compression);
+    if (ret != LIBBSA_OK)
+        return ret;
+
+    ImbueUTF8Paths();
+
+    _bsa_handle_int * handle = NULL;
+    try {
+        if (version == LIBBSA_VERSION_TES3)
+            handle = new tes3::BSA("");
+        else if (version == LIBBSA_VERSION_SSE)
+            handle = new sse::BSA("");
+        else
+            handle = new tes4::BSA("");
+
+        for (size_t i=0; i < numSources; i++)
+            sources[i]->WaitForRequests();
+        handle->MergeAssets(vector<_bsa_handle_int*>(sources, sources + numSources));
+        handle->Save(path, version, compression);
+    } catch (...) {
+        delete handle;
+        return c_error_from_exception();
+    }
+
+    *bh = handle;
+
+    return LIBBSA_OK;
+}
+
 /* Create a BSA at the specified path. The 'flags' argument consists of a set
    of bitwise OR'd constants defining the version of the BSA and the
    compression level used (and whether the compression is forced). */
@@ -169,51 +357,168 @@ LIBBSA unsigned int bsa_save (bsa_handle bh, const char * const path, const unsi
         return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
 
     //Check that flags are valid.
-    unsigned int version = 0, compression = 0;
+    unsigned int version, compression;
+    unsigned int ret = ParseSaveFlags(flags, version, compression);
+    if (ret != LIBBSA_OK)
+        return ret;
 
-        //First we need to see what flags are set.
-    if (flags & LIBBSA_VERSION_TES3 && !(flags & LIBBSA_COMPRESS_LEVEL_0))
-        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Morrowind BSAs cannot be compressed.");
+    try {
+        bh->WaitForRequests();
+        bh->Save(path, version, compression);
+    } catch (...) {
+        return c_error_from_exception();
+    }
 
+    return LIBBSA_OK;
+}
 
-    //Check for version flag duplication.
-    if (flags & LIBBSA_VERSION_TES3)
-        version = LIBBSA_VERSION_TES3;
-    if (flags & LIBBSA_VERSION_TES4) {
-        if (version > 0)
-            return c_error(LIBBSA_ERROR_INVALID_ARGS, "Cannot specify more than one version.");
-        version = LIBBSA_VERSION_TES4;
+/* Saves the given BSA as several BSAs, each no larger than maxSize bytes, the
+   first at path and the others numbered after it. */
+LIBBSA unsigned int bsa_save_split (bsa_handle bh, const char * const path, const unsigned int flags, const uint64_t maxSize, size_t * const numParts) {
+    if (bh == NULL || path == NULL || numParts == NULL)  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    unsigned int version, compression;
+    unsigned int ret = ParseSaveFlags(flags, version, compression);
+    if (ret != LIBBSA_OK)
+        return ret;
+
+    try {
+        bh->WaitForRequests();
+        vector<string> partPaths;
+        bh->SaveSplit(path, version, compression, maxSize, partPaths);
+        *numParts = partPaths.size();
+    } catch (...) {
+        return c_error_from_exception();
     }
-    if (flags & LIBBSA_VERSION_TES5) {
-        if (version > 0)
-            return c_error(LIBBSA_ERROR_INVALID_ARGS, "Cannot specify more than one version.");
-        version = LIBBSA_VERSION_TES5;
+
+    return LIBBSA_OK;
+}
+
+/* Saves the changes made to the given BSA in place, appending new data to
+   its file and rewriting its records. */
+LIBBSA unsigned int bsa_save_incremental (bsa_handle bh) {
+    if (bh == NULL)  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    try {
+        bh->WaitForRequests();
+        bh->SaveIncremental();
+    } catch (...) {
+        return c_error_from_exception();
     }
-	if (flags & LIBBSA_VERSION_SSE) {
-		if (version > 0)
-			return c_error(LIBBSA_ERROR_INVALID_ARGS, "Cannot specify more than one version.");
-		version = LIBBSA_VERSION_SSE;
-	}
 
-    //Now remove version flag from flags and check for compression flag duplication.
-    compression = flags ^ version;
-    if(!(compression & (compression-1)))
-        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Invalid compression level specified.");
+    return LIBBSA_OK;
+}
+
+/* Sets the fraction of an asset's size that compression must save for the
+   asset to be stored compressed when the BSA is saved. */
+LIBBSA unsigned int bsa_set_compression_threshold (bsa_handle bh, const float minSaving) {
+    if (bh == NULL)  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
 
     try {
-        bh->Save(path, version, compression);
+        bh->SetCompressionThreshold(minSaving);
+    } catch (error& e) {
+        return c_error(e.code(), e.what());
+    }
+
+    return LIBBSA_OK;
+}
+
+/* Sets whether assets with identical stored data share a single copy of it
+   when the BSA is saved. */
+LIBBSA unsigned int bsa_set_deduplication (bsa_handle bh, const bool enable) {
+    if (bh == NULL)  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    bh->SetDeduplication(enable);
+
+    return LIBBSA_OK;
+}
+
+/* Outputs the number of bytes of duplicate data that the last save of the
+   given BSA didn't write. */
+LIBBSA unsigned int bsa_get_deduplicated_size (bsa_handle bh, uint64_t * const bytes) {
+    if (bh == NULL || bytes == NULL)  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    *bytes = bh->GetDeduplicatedBytes();
+
+    return LIBBSA_OK;
+}
+
+/* Sets the order in which asset data is written when the given BSA is saved. */
+LIBBSA unsigned int bsa_set_data_order (bsa_handle bh, const unsigned int order) {
+    if (bh == NULL)  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    if (order == LIBBSA_DATA_ORDER_HASH)
+        bh->SetDataOrder(DATA_ORDER_HASH);
+    else if (order == LIBBSA_DATA_ORDER_FOLDER)
+        bh->SetDataOrder(DATA_ORDER_FOLDER);
+    else if (order == LIBBSA_DATA_ORDER_EXTENSION)
+        bh->SetDataOrder(DATA_ORDER_EXTENSION);
+    else
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Invalid data order specified.");
+
+    return LIBBSA_OK;
+}
+
+/* Writes the data of the given assets first, in the order given, when the
+   given BSA is saved. */
+LIBBSA unsigned int bsa_set_data_order_list (bsa_handle bh, const char * const * const assetPaths, const size_t numAssets) {
+    if (bh == NULL || (assetPaths == NULL && numAssets > 0))  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    vector<string> paths;
+    for (size_t i=0; i < numAssets; i++) {
+        if (assetPaths[i] == NULL)
+            return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+        paths.push_back(FixPath(assetPaths[i]));
+    }
+
+    try {
+        bh->SetDataOrder(paths);
+    } catch (error& e) {
+        return c_error(e.code(), e.what());
+    }
+
+    return LIBBSA_OK;
+}
+
+/* Sets the boundary that the data of assets at least minSize bytes long is
+   aligned to when the given BSA is saved. */
+LIBBSA unsigned int bsa_set_data_alignment (bsa_handle bh, const unsigned int alignment, const unsigned int minSize) {
+    if (bh == NULL)  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    try {
+        bh->SetDataAlignment(alignment, minSize);
     } catch (error& e) {
         return c_error(e.code(), e.what());
-    } catch (ios_base::failure& e) {
-        return c_error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
     }
 
     return LIBBSA_OK;
 }
 
+/* Sets the size of the smallest uncompressed asset to read from the given BSA
+   using direct I/O. */
+LIBBSA unsigned int bsa_set_direct_read_threshold (bsa_handle bh, const size_t minSize) {
+    if (bh == NULL)  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    bh->WaitForRequests();
+    bh->SetDirectReadThreshold(minSize);
+
+    return LIBBSA_OK;
+}
+
 /* Closes the BSA associated with the given handle, freeing any memory
    allocated during its use. */
 LIBBSA void bsa_close (bsa_handle bh) {
+    if (bh != NULL)
+        bh->WaitForRequests();
     delete bh;
 }
 
@@ -283,7 +588,7 @@ LIBBSA unsigned int bsa_contains_asset (bsa_handle bh, const char * const assetP
     if (bh == NULL || assetPath == NULL || result == NULL) //Check for valid args.
         return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
 
-    string assetStr = FixPath(assetPath);
+    const string& assetStr = FixPathBuffered(assetPath);
 
     *result = bh->HasAsset(assetStr);
 
@@ -297,17 +602,42 @@ LIBBSA unsigned int bsa_contains_asset (bsa_handle bh, const char * const assetP
 
 /* Replaces all the assets in the given BSA with the given assets. */
 LIBBSA unsigned int bsa_set_assets (bsa_handle bh, const bsa_asset * const assets, const size_t numAssets) {
-    if (bh == NULL || assets == NULL) //Check for valid args.
+    if (bh == NULL || (assets == NULL && numAssets > 0)) //Check for valid args.
         return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
 
+    list<PendingBsaAsset> newAssets;
+    for (size_t i=0; i < numAssets; i++) {
+        if (assets[i].sourcePath == NULL || assets[i].destPath == NULL)
+            return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+        PendingBsaAsset asset;
+        asset.extPath = assets[i].sourcePath;
+        FixPath(assets[i].destPath, asset.intPath);
+        newAssets.push_back(asset);
+    }
+
+    try {
+        bh->WaitForRequests();
+        bh->SetAssets(newAssets);
+    } catch (error& e) {
+        return c_error(e.code(), e.what());
+    }
+
     return LIBBSA_OK;
 }
 
 /* Adds a specific asset to a BSA. */
 LIBBSA unsigned int bsa_add_asset (bsa_handle bh, const bsa_asset asset) {
-    if (bh == NULL) //Check for valid args.
+    if (bh == NULL || asset.sourcePath == NULL || asset.destPath == NULL) //Check for valid args.
         return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
 
+    try {
+        bh->WaitForRequests();
+        bh->AddAsset(asset.sourcePath, FixPath(asset.destPath));
+    } catch (error& e) {
+        return c_error(e.code(), e.what());
+    }
+
     return LIBBSA_OK;
 }
 
@@ -316,6 +646,13 @@ LIBBSA unsigned int bsa_remove_asset (bsa_handle bh, const char * const assetPat
     if (bh == NULL || assetPath == NULL) //Check for valid args.
         return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
 
+    try {
+        bh->WaitForRequests();
+        bh->RemoveAsset(FixPathBuffered(assetPath));
+    } catch (error& e) {
+        return c_error(e.code(), e.what());
+    }
+
     return LIBBSA_OK;
 }
 
@@ -393,7 +730,7 @@ LIBBSA unsigned int bsa_extract_asset (bsa_handle bh, const char * const assetPa
     if (bh == NULL || assetPath == NULL || destPath == NULL) //Check for valid args.
         return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
 
-    string assetStr = FixPath(assetPath);
+    const string& assetStr = FixPathBuffered(assetPath);
 
     try {
         bh->Extract(assetStr, string(reinterpret_cast<const char*>(destPath)), overwrite);
@@ -409,7 +746,7 @@ LIBBSA unsigned int bsa_extract_asset_to_memory (bsa_handle bh, const char * con
     if (bh == NULL || assetPath == NULL || _data == NULL || _size == NULL) //Check for valid args.
         return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
 
-    string assetStr = FixPath(assetPath);
+    const string& assetStr = FixPathBuffered(assetPath);
 
     try {
         bh->Extract(assetStr, _data, _size);
@@ -420,6 +757,118 @@ LIBBSA unsigned int bsa_extract_asset_to_memory (bsa_handle bh, const char * con
     return LIBBSA_OK;
 }
 
+/*-----------------------------------
+   Asynchronous Extraction Functions
+-----------------------------------*/
+
+//Adapts a C callback to the internal completion callback.
+AsyncCallback WrapCallback(bsa_extract_callback callback, void * const userData) {
+    if (callback == NULL)
+        return AsyncCallback();
+
+    return [callback, userData](const AsyncResult& result) {
+        callback(result.requestId, result.code, result.data, result.size, userData);
+    };
+}
+
+/* Queues the extraction of a specific asset, found at assetPath, from a given BSA, to destPath. */
+LIBBSA unsigned int bsa_extract_asset_async (bsa_handle bh, const char * const assetPath, const char * const destPath, const bool overwrite, bsa_extract_callback callback, void * const userData, unsigned int * const requestId) {
+    if (bh == NULL || assetPath == NULL || destPath == NULL || requestId == NULL) //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    const string& assetStr = FixPathBuffered(assetPath);
+
+    try {
+        *requestId = bh->ExtractAsync(assetStr, string(reinterpret_cast<const char*>(destPath)), overwrite, WrapCallback(callback, userData));
+    } catch (system_error& e) {
+        return c_error(LIBBSA_ERROR_NO_MEM, e.what());  //Worker threads could not be created.
+    } catch (bad_alloc& e) {
+        return c_error(LIBBSA_ERROR_NO_MEM, e.what());
+    }
+
+    return LIBBSA_OK;
+}
+
+/* Queues the extraction of a specific asset, found at assetPath, from a given BSA, to memory. */
+LIBBSA unsigned int bsa_extract_asset_to_memory_async (bsa_handle bh, const char * const assetPath, bsa_extract_callback callback, void * const userData, unsigned int * const requestId) {
+    if (bh == NULL || assetPath == NULL || requestId == NULL) //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    const string& assetStr = FixPathBuffered(assetPath);
+
+    try {
+        *requestId = bh->ExtractAsync(assetStr, WrapCallback(callback, userData));
+    } catch (system_error& e) {
+        return c_error(LIBBSA_ERROR_NO_MEM, e.what());  //Worker threads could not be created.
+    } catch (bad_alloc& e) {
+        return c_error(LIBBSA_ERROR_NO_MEM, e.what());
+    }
+
+    return LIBBSA_OK;
+}
+
+/* Outputs the oldest completed request that had no callback, if there is one. */
+LIBBSA unsigned int bsa_get_completed_request (bsa_handle bh, unsigned int * const requestId, unsigned int * const returnCode, uint8_t ** const data, size_t * const size, bool * const completed) {
+    if (bh == NULL || requestId == NULL || returnCode == NULL || data == NULL || size == NULL || completed == NULL) //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    AsyncResult result;
+    *completed = bh->PollCompleted(result);
+
+    *requestId = result.requestId;
+    *returnCode = result.code;
+    *data = result.data;
+    *size = result.size;
+
+    return LIBBSA_OK;
+}
+
+/* Blocks until all requests submitted for the given BSA have completed. */
+LIBBSA unsigned int bsa_wait_requests (bsa_handle bh) {
+    if (bh == NULL) //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    bh->WaitForRequests();
+
+    return LIBBSA_OK;
+}
+
+/*--------------------------------
+   Patching Functions
+--------------------------------*/
+
+/* Writes a patch that turns the source BSA's file into the target BSA's file. */
+LIBBSA unsigned int bsa_create_patch (bsa_handle source, bsa_handle target, const char * const patchPath) {
+    if (source == NULL || target == NULL || patchPath == NULL)  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    try {
+        source->WaitForRequests();
+        target->WaitForRequests();
+        CreatePatch(*source, *target, patchPath);
+    } catch (error& e) {
+        return c_error(e.code(), e.what());
+    }
+
+    return LIBBSA_OK;
+}
+
+/* Applies the patch at patchPath to the BSA at sourcePath, writing the result to path. */
+LIBBSA unsigned int bsa_apply_patch (const char * const sourcePath, const char * const patchPath, const char * const path) {
+    if (sourcePath == NULL || patchPath == NULL || path == NULL)  //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    ImbueUTF8Paths();
+
+    try {
+        ApplyPatch(sourcePath, patchPath, path);
+    } catch (error& e) {
+        return c_error(e.code(), e.what());
+    }
+
+    return LIBBSA_OK;
+}
+
 /*--------------------------------
    Misc. Functions
 --------------------------------*/
@@ -429,11 +878,64 @@ LIBBSA unsigned int bsa_calc_checksum(bsa_handle bh, const char * const assetPat
         return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
 
     try {
-        *checksum = bh->CalcChecksum(FixPath(assetPath));
+        *checksum = bh->CalcChecksum(FixPathBuffered(assetPath));
+    } catch (error& e) {
+        return c_error(e.code(), e.what());
+    }
+
+    return LIBBSA_OK;
+}
+
+/* Outputs the paths of the assets in the given BSA whose stored hashes don't
+   match their paths, followed by those whose hashes collide. */
+LIBBSA unsigned int bsa_verify_hashes(bsa_handle bh, char *** const assetPaths, size_t * const numMismatched, size_t * const numColliding) {
+    if (bh == NULL || assetPaths == NULL || numMismatched == NULL || numColliding == NULL) //Check for valid args.
+        return c_error(LIBBSA_ERROR_INVALID_ARGS, "Null pointer passed.");
+
+    //Free memory if in use.
+    if (bh->extAssets != NULL) {
+        for (size_t i=0; i < bh->extAssetsNum; i++)
+            delete [] bh->extAssets[i];
+        delete [] bh->extAssets;
+        bh->extAssets = NULL;
+        bh->extAssetsNum = 0;
+    }
+
+    //Init values.
+    *assetPaths = NULL;
+    *numMismatched = 0;
+    *numColliding = 0;
+
+    HashReport report;
+    try {
+        bh->WaitForRequests();
+        bh->VerifyHashes(report);
     } catch (error& e) {
         return c_error(e.code(), e.what());
+    } catch (bad_alloc& e) {
+        return c_error(LIBBSA_ERROR_NO_MEM, e.what());
     }
 
+    if (report.mismatched.empty() && report.colliding.empty())
+        return LIBBSA_OK;
+
+    //Fill external array.
+    try {
+        bh->extAssets = new char*[report.mismatched.size() + report.colliding.size()];
+        for (size_t i=0, max=report.mismatched.size(); i < max; i++)
+            bh->extAssets[bh->extAssetsNum++] = ToNewCString(report.mismatched[i]);
+        for (size_t i=0, max=report.colliding.size(); i < max; i++)
+            bh->extAssets[bh->extAssetsNum++] = ToNewCString(report.colliding[i]);
+    } catch (bad_alloc& e) {
+        return c_error(LIBBSA_ERROR_NO_MEM, e.what());
+    } catch (error& e) {
+        return c_error(e.code(), e.what());
+    }
+
+    *assetPaths = bh->extAssets;
+    *numMismatched = report.mismatched.size();
+    *numColliding = report.colliding.size();
+
     return LIBBSA_OK;
 }
 
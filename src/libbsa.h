@@ -25,7 +25,7 @@
     @file libbsa.h
     @brief This file contains the API frontend.
 
-    @note libbsa is *not* thread safe. Thread safety is a goal, but one that has not yet been achieved. Bear this in mind if using it in a multi-threaded client.
+    @note libbsa is *not* thread safe. Thread safety is a goal, but one that has not yet been achieved. Bear this in mind if using it in a multi-threaded client. The asynchronous extraction functions do their work on libbsa's own worker threads, and can be used to keep many extractions in flight from a single client thread.
 
     @section var_sec Variable Types
 
@@ -117,6 +117,17 @@ typedef struct {
         char * destPath;    //The path of the asset when it is in the BSA.
 } bsa_asset;
 
+/**
+    @brief A function that is called when an asynchronous extraction request completes.
+    @details Called on one of libbsa's worker threads, so must be safe to call concurrently with the client's other threads and with itself. It must not call bsa_wait_requests() or bsa_close(), or any other function that waits for libbsa's worker threads, as the work waited for may be queued behind the callback, which deadlocks.
+    @param requestId The ID of the completed request, as outputted when it was submitted.
+    @param returnCode The return code of the extraction.
+    @param data For extractions to memory, the extracted asset data, which the client must free. `NULL` for extractions to file and failed extractions.
+    @param size The size of the data array.
+    @param userData The pointer given when the request was submitted.
+*/
+typedef void (*bsa_extract_callback)(const unsigned int requestId, const unsigned int returnCode, uint8_t * const data, const size_t size, void * const userData);
+
 /*********************//**
     @name Return Codes
     @brief Error codes signify an issue that caused a function to exit prematurely. If a function exits prematurely, a reversal of any changes made during its execution is attempted before it exits.
@@ -128,7 +139,7 @@ LIBBSA extern const unsigned int LIBBSA_ERROR_INVALID_ARGS;  ///< Invalid argume
 LIBBSA extern const unsigned int LIBBSA_ERROR_NO_MEM;  ///< The library was unable to allocate the required memory.
 LIBBSA extern const unsigned int LIBBSA_ERROR_FILESYSTEM_ERROR;  ///< There was an error encountered while performing a filesystem interaction (eg. reading, writing).
 LIBBSA extern const unsigned int LIBBSA_ERROR_BAD_STRING;  ///< A UTF-8 string contains characters that do not have Windows-1252 code points, or vice versa.
-LIBBSA extern const unsigned int LIBBSA_ERROR_ZLIB_ERROR;  ///< zlib reported an error during file compression or decompression.
+LIBBSA extern const unsigned int LIBBSA_ERROR_ZLIB_ERROR;  ///< zlib or LZ4 reported an error during file compression or decompression.
 LIBBSA extern const unsigned int LIBBSA_ERROR_PARSE_FAIL;  ///< There was an error in parsing a BSA.
 
 /**
@@ -148,6 +159,7 @@ LIBBSA extern const unsigned int LIBBSA_RETURN_MAX;
 LIBBSA extern const unsigned int LIBBSA_VERSION_TES3;  ///< Specifies the BSA structure supported by TES III: Morrowind.
 LIBBSA extern const unsigned int LIBBSA_VERSION_TES4;  ///< Specifies the BSA structure supported by TES IV: Oblivion.
 LIBBSA extern const unsigned int LIBBSA_VERSION_TES5;  ///< Specifies the BSA structure supported by TES V:Skyrim, Fallout 3, Fallout: New Vegas.
+LIBBSA extern const unsigned int LIBBSA_VERSION_SSE;   ///< Specifies the BSA structure supported by Skyrim: Special Edition. Its value is 0x8: earlier builds used 0x5, which is the TES III and TES V flags combined.
 
 ///@}
 /*********************//**
@@ -168,6 +180,17 @@ LIBBSA extern const unsigned int LIBBSA_COMPRESS_LEVEL_8;
 LIBBSA extern const unsigned int LIBBSA_COMPRESS_LEVEL_9;  ///< Use the highest level of compression.
 LIBBSA extern const unsigned int LIBBSA_COMPRESS_LEVEL_NOCHANGE;  ///< Use the same level of compression as was used in the opened BSA.
 
+///@}
+/*********************//**
+    @name Data Order Flags
+    @brief Used to specify the order in which asset data is written when saving a BSA. The BSA's records are always in the order its format requires.
+*************************/
+///@{
+
+LIBBSA extern const unsigned int LIBBSA_DATA_ORDER_HASH;  ///< Write data in the same order as the records, which are sorted by hash. The default. Morrowind BSAs instead keep their existing data order, with added assets' data written last, sorted by path.
+LIBBSA extern const unsigned int LIBBSA_DATA_ORDER_FOLDER;  ///< Write data grouped by folder, with folders and the files in them sorted by path.
+LIBBSA extern const unsigned int LIBBSA_DATA_ORDER_EXTENSION;  ///< Write data grouped by file extension, then sorted by path.
+
 ///@}
 
 /*********************//**
@@ -233,8 +256,40 @@ LIBBSA void bsa_cleanup ();
 LIBBSA unsigned int bsa_open (bsa_handle * const bh, const char * const path);
 
 /**
-    @brief Save a BSA at the given path. Not yet implemented.
-    @details Opens a BSA file, outputting a handle that holds an index of its contents. If the file doesn't exist then a handle for a new file will be created. You can create multiple handles.
+    @brief Initialise a new BSA handle, checking the BSA's hashes.
+    @details Opens a BSA file as `bsa_open()` does, then checks the hashes stored for its assets as `bsa_verify_hashes()` does. If any hash doesn't match its asset's path, or any assets' hashes collide, no handle is created and `LIBBSA_ERROR_PARSE_FAIL` is returned, with the error message giving the number of assets affected and the first of them. The check takes about as long as opening the BSA does, and hashes are recomputed on the handle's worker threads for large BSAs, so it can be used every time a BSA from an untrusted source is opened.
+    @param bh A pointer to the handle that is created by the function.
+    @param path A string containing the relative or absolute path to the BSA file to be opened.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_open_verified (bsa_handle * const bh, const char * const path);
+
+/**
+    @brief Create a BSA from a directory.
+    @details Packs all the files in a directory and its subdirectories into a new BSA, outputting a handle for it. Each file's path in the BSA is its path relative to the directory. The directory tree is walked and the assets are compressed using the handle's worker threads. Any existing file at the given path is replaced once the new BSA has been written. Symbolic links to directories are not followed.
+    @param bh A pointer to the handle that is created by the function.
+    @param sourcePath A string containing the relative or absolute path to the directory to pack.
+    @param path A string containing the relative or absolute path to the BSA file to be created.
+    @param flags A version flag and a compression flag combined using the bitwise OR operator, as for `bsa_save()`. `LIBBSA_COMPRESS_LEVEL_NOCHANGE` creates an uncompressed BSA.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_create_from_directory (bsa_handle * const bh, const char * const sourcePath, const char * const path, const unsigned int flags);
+
+/**
+    @brief Create a BSA by merging other BSAs.
+    @details Combines the assets of several BSAs into a new BSA, outputting a handle for it. Where more than one BSA has an asset with the same path, the asset from the BSA that comes last in the array is used. Assets' stored data is copied from the source BSAs without being decompressed, unless the compression level is changed or the data is compressed in a format that the new BSA's type doesn't use. Assets that have been added to a source handle but not yet saved are packed from their external files. Any existing file at the given path is replaced once the new BSA has been written, so it may be one of the source BSAs. The source handles can be closed once the function returns.
+    @param bh A pointer to the handle that is created by the function.
+    @param sources An array of handles for the BSAs to merge, in increasing order of priority.
+    @param numSources The size of the sources array.
+    @param path A string containing the relative or absolute path to the BSA file to be created.
+    @param flags A version flag and a compression flag combined using the bitwise OR operator, as for `bsa_save()`. `LIBBSA_COMPRESS_LEVEL_NOCHANGE` creates an uncompressed BSA that keeps each asset's data compressed or uncompressed as it is in its source.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_merge (bsa_handle * const bh, const bsa_handle * const sources, const size_t numSources, const char * const path, const unsigned int flags);
+
+/**
+    @brief Save a BSA at the given path.
+    @details Writes the contents of the handle's BSA to a file. If the compression level is changed, assets are decompressed and recompressed as necessary, with the compression work spread across the handle's worker threads. Otherwise, assets' stored data is copied unchanged.
     @param bh The handle the function acts on.
     @param path A string containing the relative or absolute path to the BSA file to be saved to.
     @param flags A version flag and a compression flag combined using the bitwise OR operator.
@@ -242,6 +297,90 @@ LIBBSA unsigned int bsa_open (bsa_handle * const bh, const char * const path);
 */
 LIBBSA unsigned int bsa_save (bsa_handle bh, const char * const path, const unsigned int flags);
 
+/**
+    @brief Save a BSA as several BSAs that are each no larger than a given size.
+    @details Divides the handle's assets between as many BSAs as are needed to keep each within the size limit, then writes them in parallel. Assets in the same folder are kept in the same BSA unless the folder is too large to fit in one. The first BSA is saved at the given path, and the others have their number inserted before the path's file extension, eg. `Textures.bsa`, `Textures1.bsa`, `Textures2.bsa`. Sizes are estimated before the BSAs are written, assuming that compression doesn't make data larger, so saving with a lower compression level than the data has can produce a BSA that is over the limit. The handle is unchanged, and still refers to the BSA it was opened from.
+    @param bh The handle the function acts on.
+    @param path A string containing the relative or absolute path to the first BSA file to be saved to.
+    @param flags A version flag and a compression flag combined using the bitwise OR operator, as for `bsa_save()`.
+    @param maxSize The maximum size in bytes of each BSA. Sizes above 4 GiB are reduced to 4 GiB, as BSAs can't be any larger.
+    @param numParts A pointer to the number of BSAs that were saved.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_save_split (bsa_handle bh, const char * const path, const unsigned int flags, const uint64_t maxSize, size_t * const numParts);
+
+/**
+    @brief Sets how much an asset must compress by to be stored compressed.
+    @details When a BSA is saved with a compression level from 1 to 9, assets in formats that are already compressed (Ogg Vorbis, FUZ, xWMA and MP3 audio) are stored uncompressed, and all other assets are compressed and then stored uncompressed if compression saved less than the given fraction of their size. Assets stored uncompressed in a compressed BSA are read by a straight copy. The default is `0.05`.
+    @param bh The handle the function acts on.
+    @param minSaving The fraction of an asset's size that compression must save, from `0` to `1`. `0` stores data uncompressed only if compressing it would make it larger.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_set_compression_threshold (bsa_handle bh, const float minSaving);
+
+/**
+    @brief Sets whether identical asset data is only stored once.
+    @details When enabled, saving a BSA compares the data stored for each asset, and assets whose stored data is identical to an earlier asset's share that asset's copy of it instead of being written again. This makes BSAs containing duplicate files smaller. Copying unchanged data is slower when enabled, as all the data must be read in to compare it. Disabled by default.
+    @param bh The handle the function acts on.
+    @param enable Whether to deduplicate data when saving.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_set_deduplication (bsa_handle bh, const bool enable);
+
+/**
+    @brief Sets the order in which asset data is written when the BSA is saved.
+    @details Storing the data of assets that are loaded together next to each other reduces seeking and makes better use of readahead. The order is used by later calls to `bsa_save()` and `bsa_save_incremental()`, and replaces any order set using `bsa_set_data_order_list()`.
+    @param bh The handle the function acts on.
+    @param order One of the data order flags.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_set_data_order (bsa_handle bh, const unsigned int order);
+
+/**
+    @brief Sets the order in which asset data is written when the BSA is saved using a list of assets.
+    @details The data of the listed assets is written first, in the order they are listed, followed by the data of any other assets, grouped by folder as for `LIBBSA_DATA_ORDER_FOLDER`. Listed assets that aren't in the BSA are ignored.
+    @param bh The handle the function acts on.
+    @param assetPaths An array of asset paths, relative to the BSA's root.
+    @param numAssets The size of the assetPaths array.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_set_data_order_list (bsa_handle bh, const char * const * const assetPaths, const size_t numAssets);
+
+/**
+    @brief Sets the boundary that large assets' data is aligned to when the BSA is saved.
+    @details Aligning asset data to the page or disk block size means that direct I/O and memory mapping can read an asset without also reading the end of the asset before it and the start of the one after it. Data that is aligned is preceded by padding where necessary, so aligning small assets wastes space. The data of saved BSAs is not aligned by default.
+    @param bh The handle the function acts on.
+    @param alignment The boundary in bytes, which must be a power of two no greater than 1048576, eg. `4096`. `0` or `1` disables alignment.
+    @param minSize The size in bytes of the stored data of the smallest asset to align. `0` aligns all assets.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_set_data_alignment (bsa_handle bh, const unsigned int alignment, const unsigned int minSize);
+
+/**
+    @brief Sets the size above which uncompressed assets are read using direct I/O.
+    @details Direct I/O reads data straight from the disk, bypassing the operating system's file cache. This avoids filling the cache with large assets that are only read once, and is most efficient for BSAs saved with their data aligned using `bsa_set_data_alignment()`. Where direct I/O isn't supported, assets are read normally. Direct I/O is disabled by default.
+    @param bh The handle the function acts on.
+    @param minSize The size in bytes of the smallest asset to read using direct I/O. `0` disables direct I/O.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_set_direct_read_threshold (bsa_handle bh, const size_t minSize);
+
+/**
+    @brief Gets how much data the last save avoided writing through deduplication.
+    @param bh The handle the function acts on.
+    @param bytes A pointer to the number of bytes of asset data that were not written because they were duplicates, in the last call to `bsa_save()` or `bsa_save_incremental()` for the handle.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_get_deduplicated_size (bsa_handle bh, uint64_t * const bytes);
+
+/**
+    @brief Save changes to a BSA in place, without rewriting its existing data.
+    @details Writes the data of assets added since the BSA was opened or last saved to the end of the BSA's file, then rewrites its header and records. Existing assets' data is left where it is, unless the larger records would overlap it, in which case it is moved to the end of the file. The data of removed assets is left in the file as unused space, so a full save using `bsa_save()` should be done occasionally to reclaim it. The BSA's version and compression are unchanged. If the save fails, eg. because the data would extend beyond the 4 GB that the records can address, the appended data is removed and the old records are put back, so the BSA is left as it was. However, a crash or power loss while the records are being rewritten can leave them incomplete, so use `bsa_save()`, which replaces the file atomically, where that matters. Not supported for Morrowind BSAs, or for BSAs that do not yet exist on disk.
+    @param bh The handle the function acts on.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_save_incremental (bsa_handle bh);
+
 /**
     @brief Closes an existing handle.
     @details Closes an existing handle, freeing any memory allocated during its use.
@@ -282,13 +421,13 @@ LIBBSA unsigned int bsa_contains_asset (bsa_handle bh, const char * const assetP
 
 /***************************************//**
     @name Content Writing Functions
-    @brief These functions are not yet implemented.
+    @brief Changes made by these functions are written when the BSA is next saved. Added assets are read from their external files then, in a single pass, so they must remain valid until bsa_save() is next called. They cannot be extracted until the BSA has been saved.
 *******************************************/
 ///@{
 
 /**
-    @brief Replaces all the assets in a BSA handle. Not yet implemented.
-    @details Replaces the index in a BSA handle with a new index containing the given assets.
+    @brief Replaces all the assets in a BSA handle.
+    @details Replaces the index in a BSA handle with a new index containing the given assets. If any of the assets are invalid, the handle is left unchanged.
     @param bh The handle the function acts on.
     @param assets The inputted array of assets.
     @param numAssets The size of the inputted array.
@@ -297,7 +436,7 @@ LIBBSA unsigned int bsa_contains_asset (bsa_handle bh, const char * const assetP
 LIBBSA unsigned int bsa_set_assets (bsa_handle bh, const bsa_asset * const assets, const size_t numAssets);
 
 /**
-    @brief Adds an asset to a BSA handle. Not yet implemented.
+    @brief Adds an asset to a BSA handle.
     @details If an asset with the same path already exists in the BSA handle, this function will return with an error code.
     @param bh The handle the function acts on.
     @param asset The asset to be added.
@@ -306,7 +445,8 @@ LIBBSA unsigned int bsa_set_assets (bsa_handle bh, const bsa_asset * const asset
 LIBBSA unsigned int bsa_add_asset (bsa_handle bh, const bsa_asset asset);
 
 /**
-    @brief Removes an asset from a BSA handle. Not yet implemented.
+    @brief Removes an asset from a BSA handle.
+    @details If the asset is not in the BSA handle, this function will return with an error code.
     @param bh The handle the function acts on.
     @param assetPath The asset to be removed.
     @returns A return code.
@@ -352,6 +492,90 @@ LIBBSA unsigned int bsa_extract_asset_to_memory (bsa_handle bh, const char * con
 ///@}
 
 
+/***************************************//**
+    @name Asynchronous Extraction Functions
+    @brief Requests are serviced by a pool of worker threads that all handles share, with one thread per hardware thread, so the calling thread does not block while assets are read and decompressed, and having many BSAs open does not multiply the number of threads. Any number of requests may be in flight at once for a handle, but the handle must not be saved or have its contents changed while they are. bsa_close() waits for any pending requests to complete.
+*******************************************/
+///@{
+
+/**
+    @brief Submits a request to extract an asset from a BSA.
+    @details Behaves as bsa_extract_asset(), but returns once the request has been queued.
+    @param bh The handle the function acts on.
+    @param assetPath The path of the asset inside the BSA.
+    @param destPath The file path to which the asset should be extracted.
+    @param overwrite If the asset is to be extracted to a path that already exists, this decides what will happen. If `true`, the existing file will be overwritten, otherwise the asset will not be extracted.
+    @param callback The function to call when the request completes. If `NULL`, the result is instead queued for retrieval by bsa_get_completed_request().
+    @param userData A pointer that is passed to the callback unchanged. May be `NULL`.
+    @param requestId The outputted ID of the request.
+    @returns A return code for the submission. The return code of the extraction itself is given on completion.
+*/
+LIBBSA unsigned int bsa_extract_asset_async (bsa_handle bh, const char * const assetPath, const char * const destPath, const bool overwrite, bsa_extract_callback callback, void * const userData, unsigned int * const requestId);
+
+/**
+    @brief Submits a request to extract an asset from a BSA to memory.
+    @details Behaves as bsa_extract_asset_to_memory(), but returns once the request has been queued.
+    @param bh The handle the function acts on.
+    @param assetPath The path of the asset inside the BSA.
+    @param callback The function to call when the request completes. If `NULL`, the result is instead queued for retrieval by bsa_get_completed_request().
+    @param userData A pointer that is passed to the callback unchanged. May be `NULL`.
+    @param requestId The outputted ID of the request.
+    @returns A return code for the submission. The return code of the extraction itself is given on completion.
+*/
+LIBBSA unsigned int bsa_extract_asset_to_memory_async (bsa_handle bh, const char * const assetPath, bsa_extract_callback callback, void * const userData, unsigned int * const requestId);
+
+/**
+    @brief Retrieves the result of a completed request that was submitted without a callback.
+    @details Results are outputted in the order in which their requests completed. This function does not block.
+    @param bh The handle the function acts on.
+    @param requestId The outputted ID of the completed request.
+    @param returnCode The outputted return code of the extraction.
+    @param data For extractions to memory, the extracted asset data, which the client must free. `NULL` for extractions to file and failed extractions.
+    @param size The size of the data array.
+    @param completed `true` if a result was outputted, `false` if no requests have completed since the last call.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_get_completed_request (bsa_handle bh, unsigned int * const requestId, unsigned int * const returnCode, uint8_t ** const data, size_t * const size, bool * const completed);
+
+/**
+    @brief Blocks until all the requests submitted for a handle have completed.
+    @details Must not be called from a completion callback, as callbacks run on one of the worker threads and would deadlock waiting for requests queued behind it.
+    @param bh The handle the function acts on.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_wait_requests (bsa_handle bh);
+
+///@}
+
+
+/***************************************//**
+    @name Patching Functions
+*******************************************/
+///@{
+
+/**
+    @brief Creates a patch that updates one BSA file to another.
+    @details Compares the assets of the two BSAs by path, hash, stored size and the CRC of their stored data, and writes a patch holding the target BSA's header and records and the data of the assets that were changed or added, with instructions to copy the rest of the data from the source BSA. The BSAs can be of any type, and are compared as they are saved on disk: assets added to either handle since it was last saved are ignored.
+    @param source The handle of the BSA that the patch is applied to.
+    @param target The handle of the BSA that applying the patch produces.
+    @param patchPath A string containing the relative or absolute path to the patch file to be created.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_create_patch (bsa_handle source, bsa_handle target, const char * const patchPath);
+
+/**
+    @brief Applies a patch to a BSA file.
+    @details Writes the BSA that the patch was created from, copying unchanged data from the source BSA. Copied data is checked against the CRCs stored in the patch, and the function fails if the source BSA is not the one the patch was created from. The output is written to a temporary file that only replaces the file at path once it is complete, so path may be the same as sourcePath. Handles open on the BSA at path are not updated.
+    @param sourcePath A string containing the relative or absolute path to the BSA file to be patched.
+    @param patchPath A string containing the relative or absolute path to the patch file.
+    @param path A string containing the relative or absolute path to the patched BSA file to be written.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_apply_patch (const char * const sourcePath, const char * const patchPath, const char * const path);
+
+///@}
+
+
 /***************************************//**
     @name Misc. Functions
 *******************************************/
@@ -367,6 +591,17 @@ LIBBSA unsigned int bsa_extract_asset_to_memory (bsa_handle bh, const char * con
 */
 LIBBSA unsigned int bsa_calc_checksum(bsa_handle bh, const char * const assetPath, uint32_t * const checksum);
 
+/**
+    @brief Checks the hashes stored for a BSA's assets.
+    @details Recomputes the hashes of the assets' paths as the games do, and outputs the paths of the assets that the games would not be able to find: those whose stored hashes, or whose folders' stored hashes, don't match their paths, and those whose hashes are the same as another asset's. Assets that have been added to the handle since the BSA was opened always have matching hashes. For large BSAs, hashes are recomputed on the handle's worker threads. The outputted array is freed on the next call to this function, `bsa_get_assets()` or `bsa_extract_assets()` for the handle, or when the handle is closed.
+    @param bh The handle the function acts on.
+    @param assetPaths The outputted array of asset paths, holding the paths of the assets with mismatched hashes, sorted, followed by those of the assets with colliding hashes, sorted. An asset can be in both parts. If no problems are found, this will be `NULL`.
+    @param numMismatched A pointer to the number of assets with mismatched hashes, which are at the start of the array.
+    @param numColliding A pointer to the number of assets with colliding hashes, which follow them.
+    @returns A return code.
+*/
+LIBBSA unsigned int bsa_verify_hashes(bsa_handle bh, char *** const assetPaths, size_t * const numMismatched, size_t * const numColliding);
+
 ///@}
 
 #ifdef __cplusplus
@@ -0,0 +1,216 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "patch.h"
+#ifndef _LIBBSA_WRAPPER_MODE
+	#include "libbsa.h"
+#else
+	#include "../cli-windows/libbsa/libwrapper.h"
+#endif
+#include "error.h"
+#include "fileio.h"
+#include "streams.h"
+#include <vector>
+#include <cstring>
+#include <boost/filesystem.hpp>
+#include <boost/crc.hpp>
+#include <boost/unordered_map.hpp>
+
+using namespace std;
+
+namespace fs = boost::filesystem;
+
+namespace libbsa {
+
+    //Calculates the CRC-32 of length bytes of in from offset, reading them through the given buffer.
+    static uint32_t CalcCrc(libbsa::ifstream& in, const uint64_t offset, const uint64_t length, std::vector<uint8_t>& buffer) {
+        boost::crc_32_type crc;
+        in.seekg(offset, ios_base::beg);
+        for (uint64_t done = 0, chunk; done < length; done += chunk) {
+            chunk = (length - done < buffer.size() ? length - done : buffer.size());
+            in.read((char*)&buffer[0], chunk);
+            crc.process_bytes(&buffer[0], chunk);
+        }
+        return crc.checksum();
+    }
+
+    void CreatePatch(const _bsa_handle_int& source, const _bsa_handle_int& target, const std::string& patchPath) {
+        vector<StoredBlock> sourceBlocks, targetBlocks;
+        source.GetStoredBlocks(sourceBlocks);
+        target.GetStoredBlocks(targetBlocks);
+
+        boost::unordered_map<string, const StoredBlock*> sourceByPath;
+        for (size_t i=0, max=sourceBlocks.size(); i < max; i++)
+            sourceByPath[sourceBlocks[i].asset->path] = &sourceBlocks[i];
+
+        try {
+            libbsa::ifstream sourceIn(fs::path(source.GetPath()), ios::binary);
+            sourceIn.exceptions(ios::failbit | ios::badbit | ios::eofbit);  //Causes ifstream::failure to be thrown if problem is encountered.
+            libbsa::ifstream targetIn(fs::path(target.GetPath()), ios::binary);
+            targetIn.exceptions(ios::failbit | ios::badbit | ios::eofbit);
+
+            PatchHeader header;
+            memcpy(header.magic, PATCH_MAGIC, sizeof(PATCH_MAGIC));
+            header.version = PATCH_VERSION;
+            header.sourceSize = fs::file_size(source.GetPath());
+            header.targetSize = fs::file_size(target.GetPath());
+
+            //Walk the target's data in order, copying unchanged assets from the source and inserting everything between them.
+            vector<PatchOp> ops;
+            uint64_t position = 0;  //The end of the target covered so far.
+            uint64_t insertedSize = 0;
+            auto insertTo = [&](const uint64_t end) {
+                if (end <= position)
+                    return;
+                if (!ops.empty() && ops.back().type == PATCH_OP_INSERT)
+                    ops.back().length += end - position;
+                else {
+                    PatchOp op;
+                    op.type = PATCH_OP_INSERT;
+                    op.crc = 0;
+                    op.offset = insertedSize;
+                    op.length = end - position;
+                    ops.push_back(op);
+                }
+                insertedSize += end - position;
+                position = end;
+            };
+
+            vector<uint8_t> buffer(1024 * 1024);
+            for (size_t i=0, max=targetBlocks.size(); i < max; i++) {
+                const StoredBlock& block = targetBlocks[i];
+                if (block.size == 0 || block.offset < position)  //Empty, or deduplicated data that has already been covered.
+                    continue;
+
+                boost::unordered_map<string, const StoredBlock*>::const_iterator it = sourceByPath.find(block.asset->path);
+                if (it == sourceByPath.end() || it->second->asset->hash != block.asset->hash || it->second->size != block.size)
+                    continue;
+
+                const uint32_t crc = CalcCrc(sourceIn, it->second->offset, block.size, buffer);
+                if (CalcCrc(targetIn, block.offset, block.size, buffer) != crc)
+                    continue;
+
+                insertTo(block.offset);
+
+                PatchOp op;
+                op.type = PATCH_OP_COPY;
+                op.crc = crc;
+                op.offset = it->second->offset;
+                op.length = block.size;
+                ops.push_back(op);
+                position += block.size;
+            }
+            insertTo(header.targetSize);
+            header.opCount = ops.size();
+
+            AtomicFile file(patchPath);
+            libbsa::fstream& out = file.Stream();
+            out.exceptions(ios::failbit | ios::badbit | ios::eofbit);
+
+            out.write((char*)&header, sizeof(PatchHeader));
+            out.write((char*)ops.data(), sizeof(PatchOp) * ops.size());
+
+            //The inserted data follows, in the same order as the operations.
+            uint64_t targetOffset = 0;
+            uint64_t outOffset = sizeof(PatchHeader) + sizeof(PatchOp) * ops.size();
+            for (size_t i=0, max=ops.size(); i < max; i++) {
+                if (ops[i].type == PATCH_OP_INSERT) {
+                    CopyData(targetIn, targetOffset, out, file.Handle(), outOffset, ops[i].length, buffer);
+                    outOffset += ops[i].length;
+                }
+                targetOffset += ops[i].length;
+            }
+
+            file.Commit();
+        } catch (ios_base::failure& e) {
+            throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
+        } catch (fs::filesystem_error& e) {
+            throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
+        }
+    }
+
+    void ApplyPatch(const std::string& sourcePath, const std::string& patchPath, const std::string& path) {
+        try {
+            libbsa::ifstream patch(fs::path(patchPath), ios::binary);
+            patch.exceptions(ios::failbit | ios::badbit | ios::eofbit);  //Causes ifstream::failure to be thrown if problem is encountered.
+
+            PatchHeader header;
+            if (fs::file_size(patchPath) < sizeof(PatchHeader))
+                throw error(LIBBSA_ERROR_PARSE_FAIL, "\"" + patchPath + "\" is not a BSA patch.");
+            patch.read((char*)&header, sizeof(PatchHeader));
+            if (memcmp(header.magic, PATCH_MAGIC, sizeof(PATCH_MAGIC)) != 0 || header.version != PATCH_VERSION)
+                throw error(LIBBSA_ERROR_PARSE_FAIL, "\"" + patchPath + "\" is not a supported BSA patch.");
+            if (header.opCount > (fs::file_size(patchPath) - sizeof(PatchHeader)) / sizeof(PatchOp))
+                throw error(LIBBSA_ERROR_PARSE_FAIL, "\"" + patchPath + "\" is corrupt.");
+            if (fs::file_size(sourcePath) != header.sourceSize)
+                throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + sourcePath + "\" is not the BSA that the patch was created from.");
+
+            vector<PatchOp> ops(header.opCount);
+            patch.read((char*)ops.data(), sizeof(PatchOp) * ops.size());
+            const uint64_t dataOffset = sizeof(PatchHeader) + sizeof(PatchOp) * ops.size();
+
+            libbsa::ifstream in(fs::path(sourcePath), ios::binary);
+            in.exceptions(ios::failbit | ios::badbit | ios::eofbit);
+
+            //The result is written to a temporary file that replaces the one at path once complete, so the source can be patched in place.
+            AtomicFile file(path);
+            libbsa::fstream& out = file.Stream();
+            out.exceptions(ios::failbit | ios::badbit | ios::eofbit);
+
+            vector<uint8_t> buffer(1024 * 1024);
+            uint64_t offset = 0;
+            for (size_t i=0, max=ops.size(); i < max; i++) {
+                const PatchOp& op = ops[i];
+                if (op.type == PATCH_OP_INSERT)
+                    CopyData(patch, dataOffset + op.offset, out, file.Handle(), offset, op.length, buffer);
+                else if (op.type == PATCH_OP_COPY) {
+                    //Copied data passes through memory so that it can be checked against the source it was matched with.
+                    boost::crc_32_type crc;
+                    in.seekg(op.offset, ios_base::beg);
+                    for (uint64_t done = 0, chunk; done < op.length; done += chunk) {
+                        chunk = (op.length - done < buffer.size() ? op.length - done : buffer.size());
+                        in.read((char*)&buffer[0], chunk);
+                        crc.process_bytes(&buffer[0], chunk);
+                        out.write((char*)&buffer[0], chunk);
+                    }
+                    if (crc.checksum() != op.crc)
+                        throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + sourcePath + "\" is not the BSA that the patch was created from.");
+                } else
+                    throw error(LIBBSA_ERROR_PARSE_FAIL, "\"" + patchPath + "\" is corrupt.");
+                offset += op.length;
+            }
+            if (offset != header.targetSize)
+                throw error(LIBBSA_ERROR_PARSE_FAIL, "\"" + patchPath + "\" is corrupt.");
+
+            //Windows can't replace a file that is open, and the source may be the file being replaced.
+            in.close();
+            patch.close();
+            file.Commit();
+        } catch (ios_base::failure& e) {
+            throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
+        } catch (fs::filesystem_error& e) {
+            throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
+        }
+    }
+}
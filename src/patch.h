@@ -0,0 +1,74 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __LIBBSA_PATCH_H__
+#define __LIBBSA_PATCH_H__
+
+#include "genericbsa.h"
+#include <stdint.h>
+#include <string>
+
+/* A patch turns one version of a BSA file (the source) into another (the
+   target). It is a header, followed by an array of operations, followed by the
+   data of the insert operations. Applying the operations in order writes the
+   target from start to finish.
+
+   Assets are matched between the two BSAs by path, and an asset whose hash,
+   stored size and stored data CRC are unchanged is copied from the source.
+   Everything else in the target, ie. its header and records, changed and added
+   assets' data and any padding, is stored in the patch.
+*/
+
+namespace libbsa {
+
+    const char PATCH_MAGIC[4] = {'B', 'S', 'A', 'P'};  //Written and compared byte by byte.
+    const uint32_t PATCH_VERSION = 1;
+
+    const uint32_t PATCH_OP_INSERT = 0;  //Writes data stored in the patch. offset is from the start of the patch's data.
+    const uint32_t PATCH_OP_COPY = 1;    //Writes data copied from the source. offset is from the start of the source.
+
+    struct PatchHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t sourceSize;  //The size of the source file, as a quick check that a patch is applied to the right BSA.
+        uint64_t targetSize;
+        uint64_t opCount;
+    };
+
+    struct PatchOp {
+        uint32_t type;
+        uint32_t crc;       //For copy operations, the CRC-32 of the data, which is checked as it is copied.
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    //Writes a patch that turns the file of source into the file of target. Only assets that have been saved are matched.
+    void CreatePatch(const _bsa_handle_int& source, const _bsa_handle_int& target, const std::string& patchPath);
+
+    //Writes the result of applying a patch to the file at sourcePath to path, which may be the same as sourcePath.
+    //Throws if the patch was not created from that file.
+    void ApplyPatch(const std::string& sourcePath, const std::string& patchPath, const std::string& path);
+}
+
+#endif
@@ -0,0 +1,87 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "libbsa.h"
+
+#include <iostream>
+#include <string>
+
+using std::cout;
+using std::endl;
+
+/* Creates and applies patches that update one version of a BSA to another,
+   so that an update only needs to ship the data that changed.
+
+   Usage: libbsa-patch create old.bsa new.bsa patch
+          libbsa-patch apply old.bsa patch new.bsa
+
+   Applying a patch checks that the data copied from the old BSA is what the
+   patch was created from. The new BSA may be written over the old one.
+*/
+
+//Prints the details of a failed call and returns its code.
+unsigned int Fail(const std::string& what, const unsigned int ret) {
+    const char * message = NULL;
+    bsa_get_error_message(&message);
+    cout << what << " Return code: " << ret;
+    if (message != NULL)
+        cout << ", details: " << message;
+    cout << endl;
+    return ret;
+}
+
+int main(int argc, char * argv[]) {
+    const std::string command = (argc == 5 ? argv[1] : "");
+    unsigned int ret;
+
+    if (command == "create") {
+        bsa_handle source, target;
+        ret = bsa_open(&source, argv[2]);
+        if (ret != LIBBSA_OK)
+            return Fail("Could not read \"" + std::string(argv[2]) + "\".", ret);
+        ret = bsa_open(&target, argv[3]);
+        if (ret != LIBBSA_OK) {
+            bsa_close(source);
+            return Fail("Could not read \"" + std::string(argv[3]) + "\".", ret);
+        }
+
+        ret = bsa_create_patch(source, target, argv[4]);
+        bsa_close(source);
+        bsa_close(target);
+        if (ret != LIBBSA_OK)
+            return Fail("Could not create patch.", ret);
+    } else if (command == "apply") {
+        ret = bsa_apply_patch(argv[2], argv[3], argv[4]);
+        if (ret != LIBBSA_OK)
+            return Fail("Could not apply patch.", ret);
+    } else {
+        cout << "Usage: libbsa-patch create old.bsa new.bsa patch" << endl
+             << "       libbsa-patch apply old.bsa patch new.bsa" << endl;
+        return 1;
+    }
+
+    bsa_cleanup();
+
+    return 0;
+}
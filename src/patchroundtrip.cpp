@@ -0,0 +1,179 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "libbsa.h"
+
+#include <stdint.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+/* Round-trips synthetic BSAs through patch creation and application.
+
+   Usage: libbsa-patch-roundtrip [workingDir]
+
+   A source BSA is saved from generated files, and a target BSA from the same
+   files with one changed, one removed and one added. It is then checked that:
+     - a patch from the source to the target can be created, and is smaller
+       than the target, as unchanged data is copied rather than stored,
+     - applying it to the source reproduces the target exactly, both to a new
+       path and in place,
+     - applying it to a file it wasn't created from fails.
+   Files are written to a temporary directory unless one is given. Returns 0
+   if every check passes.
+*/
+
+string ReadFile(const fs::path& path) {
+    std::ifstream in(path.string().c_str(), std::ios::binary);
+    return string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const fs::path& path, const string& data) {
+    std::ofstream out(path.string().c_str(), std::ios::binary);
+    out.write(data.data(), data.length());
+}
+
+int failures = 0;
+
+void Check(const bool passed, const string& description) {
+    cout << (passed ? "PASS " : "FAIL ") << description << endl;
+    if (!passed)
+        failures++;
+}
+
+//Generates data that compresses a little, so that compressed data is stored.
+string GenerateData(const size_t size, uint32_t seed) {
+    string data;
+    for (size_t i=0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        data += (char)('a' + (seed >> 16) % 8);
+    }
+    return data;
+}
+
+//Saves a new BSA at path holding the files in sources, at the matching paths in dests.
+unsigned int SaveArchive(const fs::path& path, const vector<fs::path>& sources, const vector<string>& dests) {
+    vector<string> sourcePaths;
+    for (size_t i=0; i < sources.size(); i++)
+        sourcePaths.push_back(sources[i].string());
+    vector<string> destPaths(dests);
+
+    vector<bsa_asset> assets(sources.size());
+    for (size_t i=0; i < assets.size(); i++) {
+        assets[i].sourcePath = &sourcePaths[i][0];
+        assets[i].destPath = &destPaths[i][0];
+    }
+
+    bsa_handle bh;
+    unsigned int ret = bsa_open(&bh, path.string().c_str());
+    if (ret != LIBBSA_OK)
+        return ret;
+    ret = bsa_set_assets(bh, assets.data(), assets.size());
+    if (ret == LIBBSA_OK)
+        ret = bsa_save(bh, path.string().c_str(), LIBBSA_VERSION_TES4 | LIBBSA_COMPRESS_LEVEL_9);
+    bsa_close(bh);
+    return ret;
+}
+
+int main(int argc, char * argv[]) {
+    const fs::path dir = (argc > 1 ? fs::path(argv[1]) : fs::temp_directory_path() / fs::unique_path("libbsa-patch-%%%%-%%%%"));
+    fs::create_directories(dir);
+
+    const char * paths[] = {
+        "meshes/clutter/bucket01.nif",
+        "meshes/clutter/bucket02.nif",
+        "textures/clutter/bucket01.dds",
+        "textures/clutter/bucket01_n.dds",
+        "sound/fx/npc/bucket/kick_01.wav",
+        "interface/books/bucket.txt"
+    };
+    vector<fs::path> sources;
+    vector<string> dests;
+    for (size_t i=0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        sources.push_back(dir / ("source" + std::to_string(i)));
+        dests.push_back(paths[i]);
+        WriteFile(sources.back(), GenerateData(1000 + i * 20011, (uint32_t)i));
+    }
+
+    const fs::path source = dir / "source.bsa";
+    Check(SaveArchive(source, sources, dests) == LIBBSA_OK, "save source BSA");
+
+    //The target changes the data of the second asset, drops the last and adds another.
+    const fs::path changed = dir / "changed";
+    WriteFile(changed, GenerateData(3000, 99));
+    const fs::path added = dir / "added";
+    WriteFile(added, GenerateData(500, 100));
+    vector<fs::path> targetSources(sources.begin(), sources.end() - 1);
+    vector<string> targetDests(dests.begin(), dests.end() - 1);
+    targetSources[1] = changed;
+    targetSources.push_back(added);
+    targetDests.push_back("meshes/clutter/bucket03.nif");
+
+    const fs::path target = dir / "target.bsa";
+    Check(SaveArchive(target, targetSources, targetDests) == LIBBSA_OK, "save target BSA");
+
+    const fs::path patch = dir / "target.bsap";
+    bsa_handle sourceHandle, targetHandle;
+    unsigned int ret = bsa_open(&sourceHandle, source.string().c_str());
+    if (ret == LIBBSA_OK) {
+        ret = bsa_open(&targetHandle, target.string().c_str());
+        if (ret == LIBBSA_OK) {
+            ret = bsa_create_patch(sourceHandle, targetHandle, patch.string().c_str());
+            bsa_close(targetHandle);
+        }
+        bsa_close(sourceHandle);
+    }
+    Check(ret == LIBBSA_OK, "create patch");
+    Check(ret == LIBBSA_OK && fs::file_size(patch) < fs::file_size(target), "patch is smaller than the target");
+
+    const fs::path patched = dir / "patched.bsa";
+    ret = bsa_apply_patch(source.string().c_str(), patch.string().c_str(), patched.string().c_str());
+    Check(ret == LIBBSA_OK && ReadFile(patched) == ReadFile(target), "applied patch reproduces the target");
+
+    const fs::path inPlace = dir / "in-place.bsa";
+    fs::copy_file(source, inPlace, fs::copy_option::overwrite_if_exists);
+    ret = bsa_apply_patch(inPlace.string().c_str(), patch.string().c_str(), inPlace.string().c_str());
+    Check(ret == LIBBSA_OK && ReadFile(inPlace) == ReadFile(target), "patch applied in place reproduces the target");
+
+    const fs::path wrong = dir / "wrong.bsa";
+    ret = bsa_apply_patch(target.string().c_str(), patch.string().c_str(), wrong.string().c_str());
+    Check(ret != LIBBSA_OK && !fs::exists(wrong), "patch is rejected for another BSA");
+
+    if (argc < 2)
+        fs::remove_all(dir);
+
+    cout << (failures == 0 ? "All checks passed." : "Some checks failed.") << endl;
+    return failures == 0 ? 0 : 1;
+}
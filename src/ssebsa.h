@@ -24,43 +24,25 @@ along with libbsa.  If not, see
 #ifndef __LIBBSA_SSESTRUCTS_H__
 #define __LIBBSA_SSESTRUCTS_H__
 
-#include "genericbsa.h"
+#include "tes4typebsa.h"
+#include "compression.h"
 #include <stdint.h>
 #include <string>
-#include <boost/filesystem.hpp>
-#include <boost/algorithm/string.hpp>
 
 /* File format infos:
 <None currently available>
 
 This header file defines the constants, structures and functions specific
-to the Sse-type BSA, which is used by Skyrim: Special Edition
+to the Sse-type BSA, which is used by Skyrim: Special Edition. It is a
+Tes4-type BSA with a wider folder record and LZ4 compression, and shares
+the Tes4-type archive engine in tes4typebsa.h.
 */
 
 namespace libbsa {
 	namespace sse {
 
-		const uint32_t BSA_MAGIC = '\0ASB';
 		const uint32_t BSA_VERSION_SSE = 0x69;
 
-		const uint32_t BSA_FOLDER_RECORD_OFFSET = 36;  //Folder record offset for SSE-type BSAs is constant.
-
-		const uint32_t BSA_COMPRESSED = 0x0004;  //If this flag is present in the archiveFlags header field, then the BSA file data is compressed.
-
-		const uint32_t FILE_INVERT_COMPRESSED = 0x40000000;  //Inverts the file data compression status for the specific file this flag is set for.
-
-		struct Header {
-			uint32_t fileId;
-			uint32_t version;
-			uint32_t offset;
-			uint32_t archiveFlags;
-			uint32_t folderCount;
-			uint32_t fileCount;
-			uint32_t totalFolderNameLength;
-			uint32_t totalFileNameLength;
-			uint32_t fileFlags;
-		};
-
 		struct FolderRecord {
 			uint64_t nameHash;  //Hash of folder name.
 			uint32_t count;     //Number of files in folder.
@@ -68,38 +50,21 @@ namespace libbsa {
 			uint64_t offset;    //Offset to the fileRecords for this folder, including the folder name, from the beginning of the file.
 		};
 
-		struct FileRecord {
-			uint64_t nameHash;  //Hash of the filename.
-			uint32_t size;      //Size of the data. See TES4Mod wiki page for details.
-			uint32_t offset;    //Offset to the raw file data, from byte 0.
-		};
+		//Format traits for the Tes4-type BSA engine.
+		struct Format {
+			typedef sse::FolderRecord FolderRecord;
+			typedef Lz4FrameCodec Codec;
 
-		//SSE-type BSA class.
-		class BSA : public _bsa_handle_int {
-		public:
-			BSA(const std::string& path);
-			void Save(std::string path, const uint32_t version, const uint32_t compression);
-		private:
-			std::pair<uint8_t*, size_t> ReadData(libbsa::ifstream& in, const libbsa::BsaAsset& data);
-
-			uint32_t HashString(const std::string& str);
-			uint64_t CalcHash(const std::string& path, const std::string& ext);
-
-			uint32_t archiveFlags;
-			uint32_t fileFlags;
+			static const char * Name() { return "SSEBSA"; }
+			static bool IsVersion(const uint32_t bsaVersion) { return bsaVersion == BSA_VERSION_SSE; }
+			static uint32_t HeaderVersion(const uint32_t version);
+			static const char * VersionError() { return "SSE-type BSAs can only be saved as Skyrim: Special Edition BSAs."; }
 		};
 
-		bool hash_comp(const BsaAsset& first, const BsaAsset& second);
-
-		//Comparison class for list::unique.
-		class path_comp {
-		public:
-			bool operator() (const BsaAsset& first, const BsaAsset& second) {
-				return first.path == second.path;
-			}
-		};
+		//SSE-type BSA class.
+		typedef tes4type::BSA<Format> BSA;
 
-		//Check if a given file is a Tes4-type BSA.
+		//Check if a given file is a SSE-type BSA.
 		bool IsBSA(const std::string& path);
 	}
 }
@@ -29,6 +29,10 @@
 	#include "../cli-windows/libbsa/libwrapper.h"
 #endif
 #include "streams.h"
+#include "hashes.h"
+#include <algorithm>
+#include <vector>
+#include <cstring>
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
@@ -59,23 +63,30 @@ namespace libbsa { namespace tes3 {
 
             Load the FileRecordData (size,offset), filename offsets, filename records and hashes into memory, then work on them there.
             */
-            FileRecord * fileRecords;
-            uint32_t * filenameOffsets;
-            uint8_t * filenameRecords;
-            uint64_t * hashRecords;
-            uint32_t filenameRecordsSize = header.hashOffset - sizeof(FileRecord) * header.fileCount - sizeof(uint32_t) * header.fileCount;
+            //The header's sizes are checked against the file's before anything is allocated for them.
+            const uint64_t fileSize = fs::file_size(path);
+            const uint64_t recordsSize = (uint64_t)(sizeof(FileRecord) + sizeof(uint32_t)) * header.fileCount;
+            const uint64_t startOfData = sizeof(Header) + (uint64_t)header.hashOffset + (uint64_t)header.fileCount * sizeof(uint64_t);
+            if (header.hashOffset < recordsSize || startOfData > fileSize)
+                throw error(LIBBSA_ERROR_PARSE_FAIL, "TES3BSA: Structure of \"" + path + "\" is invalid.");
+
+            vector<FileRecord> fileRecords;
+            vector<uint32_t> filenameOffsets;
+            vector<uint8_t> filenameRecords;
+            vector<uint64_t> hashRecords;
+            const uint32_t filenameRecordsSize = header.hashOffset - recordsSize;
             try {
-                fileRecords = new FileRecord[header.fileCount];
-                in.read((char*)fileRecords, sizeof(FileRecord) * header.fileCount);
+                fileRecords.resize(header.fileCount);
+                in.read((char*)fileRecords.data(), sizeof(FileRecord) * header.fileCount);
 
-                filenameOffsets = new uint32_t[header.fileCount];
-                in.read((char*)filenameOffsets, sizeof(uint32_t) * header.fileCount);
+                filenameOffsets.resize(header.fileCount);
+                in.read((char*)filenameOffsets.data(), sizeof(uint32_t) * header.fileCount);
 
-                filenameRecords = new uint8_t[filenameRecordsSize];
-                in.read((char*)filenameRecords, sizeof(uint8_t) * filenameRecordsSize);
+                filenameRecords.resize(filenameRecordsSize);
+                in.read((char*)filenameRecords.data(), sizeof(uint8_t) * filenameRecordsSize);
 
-                hashRecords = new uint64_t[header.fileCount];
-                in.read((char*)hashRecords, sizeof(uint64_t) * header.fileCount);
+                hashRecords.resize(header.fileCount);
+                in.read((char*)hashRecords.data(), sizeof(uint64_t) * header.fileCount);
             } catch (bad_alloc& e) {
                 throw error(LIBBSA_ERROR_NO_MEM, e.what());
             }
@@ -83,170 +94,135 @@ namespace libbsa { namespace tes3 {
             in.close(); //No longer need the file open.
 
             //All three arrays have the same ordering, so we just need to loop through one and look at the corresponding position in the other.
-            uint32_t startOfData = sizeof(Header) + header.hashOffset + header.fileCount * sizeof(uint64_t);
             for (uint32_t i=0; i < header.fileCount; i++) {
                 BsaAsset fileData;
                 fileData.size = fileRecords[i].size;
                 fileData.offset = startOfData + fileRecords[i].offset;  //Internally, offsets are adjusted so that they're from file beginning.
                 fileData.hash = hashRecords[i];
+                if (fileData.offset + fileData.size > fileSize || filenameOffsets[i] >= filenameRecordsSize)
+                    throw error(LIBBSA_ERROR_PARSE_FAIL, "TES3BSA: Structure of \"" + path + "\" is invalid.");
 
                 //Now we need to build the file path. First: file name.
-                //Find position of null pointer.
-                char * nptr = strchr((char*)(filenameRecords + filenameOffsets[i]), '\0');
+                //Find position of null pointer, which must be within the filename records.
+                const char * filename = (const char*)(filenameRecords.data() + filenameOffsets[i]);
+                const char * nptr = (const char*)memchr(filename, '\0', filenameRecordsSize - filenameOffsets[i]);
                 if (nptr == NULL)
                     throw error(LIBBSA_ERROR_PARSE_FAIL, "TES3BSA: Structure of \"" + path + "\" is invalid.");
 
-                fileData.path = ToUTF8(string((char*)(filenameRecords + filenameOffsets[i]), nptr - (char*)(filenameRecords + filenameOffsets[i])));
+                fileData.path = ToUTF8(string(filename, nptr - filename));
 
                 //Finally, add fileData to list.
                 assets.push_back(fileData);
             }
 
             hashOffset = header.hashOffset;
-
-            delete [] fileRecords;
-            delete [] filenameOffsets;
-            delete [] filenameRecords;
-            delete [] hashRecords;
         }
     }
 
     void BSA::Save(std::string path, const uint32_t version, const uint32_t compression) {
         //Version and compression have been validated.
 
-        if (path == filePath)
-            path += ".new";  //Avoid read/write collisions.
-
-        libbsa::ifstream in(fs::path(filePath), ios::binary);
-        in.exceptions(ios::failbit | ios::badbit | ios::eofbit);  //Causes ifstream::failure to be thrown if problem is encountered.
-
-        libbsa::ofstream out(fs::path(path), ios::binary | ios::trunc);
-        out.exceptions(ios::failbit | ios::badbit | ios::eofbit);  //Causes ifstream::failure to be thrown if problem is encountered.
+        //The records, names and hashes are all in hash order, so lay them out from one sorted index.
+        vector<BsaAsset*> records;
+        records.reserve(assets.size());
+        for (list<BsaAsset>::iterator it = assets.begin(), endIt = assets.end(); it != endIt; ++it)
+            records.push_back(&*it);
+        sort(records.begin(), records.end(), hash_comp);
 
-        //Build file header.
         Header header;
-        header.version = tes3::BSA_VERSION_TES3;
-        header.fileCount = assets.size();
-        //Can't set hashOffset until the size of the names array is known.
-
-        //Allocate memory for info blocks.
-        tes3::FileRecord * fileRecords;
-        uint32_t * filenameOffsets;
-        uint64_t * hashes;
-        //Can't allocate memory for filenames, because we don't know how long they are to be. Use a string buffer instead.
-        string filenameRecords;
-        try {
-            fileRecords = new tes3::FileRecord[header.fileCount];
-            filenameOffsets = new uint32_t[header.fileCount];
-            hashes = new uint64_t[header.fileCount];
-        } catch (bad_alloc& e) {
-            throw error(LIBBSA_ERROR_NO_MEM, e.what());
-        }
+        header.version = BSA_VERSION_TES3;
+        header.fileCount = records.size();
 
-        //Need to update the file data offsets before populating the records. This requires the list to be sorted by path.
-        //We still want to keep the old offsets for writing the raw file data though.
-        assets.sort(path_comp);
-        uint32_t fileDataOffset = 0;
-        vector<uint32_t> oldOffsets;
-libbsa::ofstream debug(fs::path("debug.txt"));
-        for (list<BsaAsset>::iterator it = assets.begin(), endIt = assets.end(); it != endIt; ++it) {
-
-
-
-uint32_t offset = it->offset - (hashOffset + sizeof(Header) + header.fileCount * sizeof(uint64_t));
-if (offset != fileDataOffset)
-    debug << it->path << '\t' << offset << '\t' << fileDataOffset << '\t' << int(offset - fileDataOffset) << endl;
-
-
-            oldOffsets.push_back(it->offset);
-            it->offset = fileDataOffset;  //This results in the wrong offsets for some files - see README for details.
-//it->offset -= hashOffset + sizeof(Header) + header.fileCount * sizeof(uint64_t);
-            fileDataOffset += it->size;
-        }
-debug.close();
-
-        //file data, names and hashes are all done in hash order, so sort list by hash.
-        assets.sort(hash_comp);
-        uint32_t filenameOffset = 0;
-        uint32_t i = 0;
-        for (list<BsaAsset>::const_iterator it = assets.begin(), endIt = assets.end(); it != endIt; ++it) {
-            //Set size and offset.
-            fileRecords[i].size = it->size;
-            fileRecords[i].offset = it->offset;
-
-            //Set filename offset, and store filename.
-            filenameOffsets[i] = filenameOffset;
-
-            //Transcode.
-            string filename = FromUTF8(it->path) + '\0';
-            filenameRecords += filename;
-            filenameOffset += filename.length();
-
-            hashes[i] = it->hash;
-            i++;
+        vector<FileRecord> fileRecords(header.fileCount);  //Filled in once the data has been written.
+        vector<uint32_t> filenameOffsets(header.fileCount);
+        vector<uint64_t> hashes(header.fileCount);
+        string filenameRecords;
+        for (size_t i=0, max=records.size(); i < max; i++) {
+            filenameOffsets[i] = filenameRecords.length();
+            filenameRecords += FromUTF8(records[i]->path) + '\0';
+            hashes[i] = records[i]->hash;
         }
 
-        //We can now calculate the header's hashOffset to complete it.
+        //The names' size gives the hash table's offset, and so where the data starts, which record offsets are relative to.
         header.hashOffset = (sizeof(FileRecord) + sizeof(uint32_t)) * header.fileCount + filenameRecords.length();
+        const uint32_t dataOffset = sizeof(Header) + header.hashOffset + sizeof(uint64_t) * header.fileCount;
+
+        //By default, existing data is written in the order it's stored in, so that saving without changes reproduces the
+        //BSA exactly, and added assets' data follows in path order. Another data order can be set instead.
+        vector<size_t> order;
+        GetDataOrder(vector<const BsaAsset*>(records.begin(), records.end()), order);
+        if (dataOrder == DATA_ORDER_HASH) {
+            sort(order.begin(), order.end(), [&records](const size_t first, const size_t second) {
+                //Assets that have not been written have 0 offsets.
+                const BsaAsset& f = *records[first];
+                const BsaAsset& s = *records[second];
+                if ((f.offset == 0) != (s.offset == 0))
+                    return s.offset == 0;
+                if (f.offset != s.offset)
+                    return f.offset < s.offset;
+                if (f.size != s.size)
+                    return f.size < s.size;  //Empty assets share the offset of the data that follows them.
+                return f.path < s.path;
+            });
+        }
 
-        //Only thing left to do is to write out the completed BSA sections, then
-        //read the file data from the input and write it to the output.
-
-        //Write out completed BSA sections.
-        out.write((char*)&header, sizeof(Header));   //ok
-        out.write((char*)fileRecords, sizeof(FileRecord) * header.fileCount);  //some offsets are wrong
-        out.write((char*)filenameOffsets, sizeof(uint32_t) * header.fileCount);  //ok
-        out.write(filenameRecords.data(), filenameRecords.length());  //OK.
-        out.write((char*)hashes, sizeof(uint64_t) * header.fileCount);       //OK
-
-        delete [] fileRecords;
-        delete [] filenameOffsets;
-        delete [] hashes;
-
-        //Now write out raw file data in alphabetical filename order.
-        assets.sort(path_comp);
-        i = 0;
-        for (list<BsaAsset>::const_iterator it = assets.begin(), endIt = assets.end(); it != endIt; ++it) {
-            //it->second.offset is the offset for the data in the new file. We don't need it though, because we're doing writes in sequence.
-            //We want the offset for the data in the old file.
-            //This doesn't yet support assets that have been added to the BSA.
-
-            //Allocate memory for this file's data, read it in, write it out, then free memory.
-            uint8_t * fileData;
-            try {
-                fileData = new uint8_t[it->size];  //Doesn't matter where we get size from.
-            } catch (bad_alloc& e) {
-                throw error(LIBBSA_ERROR_NO_MEM, e.what());
+        boost::unordered_map<string, const string*> pendingSources;
+        GetPendingSources(pendingSources);
+        vector<SaveBlock> blocks;
+        blocks.reserve(order.size());
+        for (size_t k=0, max=order.size(); k < max; k++) {
+            BsaAsset& source = *records[order[k]];
+
+            boost::unordered_map<string, const string*>::const_iterator pendingIt = pendingSources.find(source.path);
+            boost::unordered_map<string, MergedAsset>::const_iterator mergedIt = mergedAssets.find(source.path);
+            if (pendingIt != pendingSources.end())
+                blocks.push_back(PendingBlock(source, *pendingIt->second, false, UINT32_MAX - dataOffset));
+            else if (mergedIt != mergedAssets.end())
+                blocks.push_back(MergedBlock(source, mergedIt->second, 0));  //Morrowind BSAs can't hold compressed data.
+            else {
+                SaveBlock block;
+                block.source = &source;
+                block.size = source.size;
+                blocks.push_back(block);
             }
+        }
 
-            //Read data in.
-            in.seekg(oldOffsets[i], ios_base::beg);
-            in.read((char*)fileData, it->size);
-
-            //Write data out.
-            out.write((char*)fileData, it->size);
-
-            //Free memory.
-            delete [] fileData;
+        //The archive is written to a temporary file that replaces the one at path once complete.
+        AtomicFile file(path);
+        libbsa::fstream& out = file.Stream();
+        out.exceptions(ios::failbit | ios::badbit | ios::eofbit);  //Causes ifstream::failure to be thrown if problem is encountered.
 
-            i++;
+        out.write((char*)&header, sizeof(Header));
+        out.write((char*)fileRecords.data(), sizeof(FileRecord) * header.fileCount);
+        out.write((char*)filenameOffsets.data(), sizeof(uint32_t) * header.fileCount);
+        out.write(filenameRecords.data(), filenameRecords.length());
+        out.write((char*)hashes.data(), sizeof(uint64_t) * header.fileCount);
+
+        //Morrowind BSAs are never compressed, so all data is copied as-is.
+        WriteBlocks(out, file.Handle(), blocks, 0);
+
+        //Now that the data sizes and offsets are known, fill them in and rewrite the file records.
+        //Record sizes and offsets are 32-bit, so the data section can't extend beyond 4 GB.
+        for (size_t k=0, max=blocks.size(); k < max; k++) {
+            if (blocks[k].offset - dataOffset > UINT32_MAX || blocks[k].size > UINT32_MAX)
+                throw error(LIBBSA_ERROR_INVALID_ARGS, "The BSA's asset data is too large: file records can't address data beyond 4 GB.");
+            fileRecords[order[k]].size = blocks[k].size;
+            fileRecords[order[k]].offset = blocks[k].offset - dataOffset;
         }
+        out.seekp(sizeof(Header), ios_base::beg);
+        out.write((char*)fileRecords.data(), sizeof(FileRecord) * header.fileCount);
+
+        file.Commit();
 
         //Update member vars.
+        for (size_t k=0, max=blocks.size(); k < max; k++) {
+            records[order[k]]->size = blocks[k].size;
+            records[order[k]]->offset = blocks[k].offset;
+        }
+        pendingAssets.clear();
+        mergedAssets.clear();
         filePath = path;
         hashOffset = header.hashOffset;
-
-        in.close();
-        out.close();
-
-        //Now rename the output file.
-    /*  if (fs::path(path).extension().string() == ".new") {
-            try {
-                fs::rename(path, fs::path(path).stem());
-            } catch (fs::filesystem_error& e) {
-                throw error(LIBBSA_ERROR_FILESYSTEM_ERROR, e.what());
-            }
-        }*/
     }
 
     std::pair<uint8_t*,size_t> BSA::ReadData(libbsa::ifstream& in, const libbsa::BsaAsset& data) {
@@ -259,43 +235,40 @@ debug.close();
             throw error(LIBBSA_ERROR_NO_MEM, e.what());
         }
 
-        in.seekg(data.offset, ios_base::beg);
-        in.read((char*)buffer, data.size);
+        ReadStoredData(in, data.offset, buffer, data.size);
 
         return pair<uint8_t*,size_t>(buffer, data.size);
     }
 
-    uint64_t BSA::CalcHash(const std::string& path) {
-        size_t len = path.length();
-        uint32_t hash1 = 0;
-        uint32_t hash2 = 0;
-        unsigned l = path.length() >> 1;
-        unsigned sum, off, temp, i, n;
+    _bsa_handle_int * BSA::CreateEmpty() const {
+        return new BSA("");
+    }
 
-        for (sum = off = i = 0; i < l; i++) {
-            sum ^= (((unsigned)(path[i])) << (off & 0x1F));
-            off += 8;
-        }
-        hash1 = sum;
-
-        for (sum = off = 0; i < len; i++) {
-            temp = (((unsigned)(path[i])) << (off & 0x1F));
-            sum ^= temp;
-            n = temp & 0x1F;
-            sum = (sum << (32 - n)) | (sum >> n);
-            off += 8;
-        }
-        hash2 = sum;
+    uint64_t BSA::HashPath(const std::string& assetPath) {
+        const string path = FromUTF8(assetPath);
+        return Tes3Hash(path.data(), path.length());
+    }
 
-        return ((uint64_t)hash1) + ((uint64_t)hash2 << 32);
+    void BSA::HashPaths(const std::vector<const std::string*>& assetPaths, std::vector<uint64_t>& hashes) {
+        //The paths are converted into one buffer, one after another, and hashed together.
+        string names, path;
+        vector<size_t> offsets(1, 0);
+        offsets.reserve(assetPaths.size() + 1);
+        for (size_t i=0, max=assetPaths.size(); i < max; i++) {
+            FromUTF8(*assetPaths[i], path);
+            names += path;
+            offsets.push_back(names.length());
+        }
+        hashes.resize(assetPaths.size());
+        Tes3Hashes(names.data(), offsets.data(), assetPaths.size(), hashes.data());
     }
 
-    bool hash_comp(const BsaAsset& first, const BsaAsset& second) {
+    bool hash_comp(const BsaAsset * first, const BsaAsset * second) {
         //Data losses are intentional.
-        uint32_t f1 = first.hash;
-        uint32_t f2 = first.hash >> 32;
-        uint32_t s1 = second.hash;
-        uint32_t s2 = second.hash >> 32;
+        uint32_t f1 = first->hash;
+        uint32_t f2 = first->hash >> 32;
+        uint32_t s1 = second->hash;
+        uint32_t s2 = second->hash >> 32;
 
         if (f1 < s1)
             return true;
@@ -306,11 +279,7 @@ debug.close();
         else if (f2 > s2)
             return false;
 
-        return first.path < second.path;
-    }
-
-    bool path_comp(const BsaAsset& first, const BsaAsset& second) {
-        return first.path < second.path;
+        return first->path < second->path;
     }
 
     //Check if a given file is a Tes3-type BSA.
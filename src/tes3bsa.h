@@ -28,6 +28,7 @@
 #include "streams.h"
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 /* File format infos:
     <http://www.uesp.net/wiki/Tes3Mod:BSA_File_Format>
@@ -55,17 +56,18 @@ namespace libbsa { namespace tes3 {
     public:
         BSA(const std::string& path);
         void Save(std::string path, const uint32_t version, const uint32_t compression);
+    protected:
+        _bsa_handle_int * CreateEmpty() const;
+        uint64_t HashPath(const std::string& assetPath);
+        void HashPaths(const std::vector<const std::string*>& assetPaths, std::vector<uint64_t>& hashes);
     private:
         std::pair<uint8_t*,size_t> ReadData(libbsa::ifstream& in, const libbsa::BsaAsset& data);
 
-        uint64_t CalcHash(const std::string& path);
-
         uint32_t hashOffset;
     };
 
-    bool hash_comp(const BsaAsset& first, const BsaAsset& second);
-
-    bool path_comp(const BsaAsset& first, const BsaAsset& second);
+    //Orders assets by hash, in the order their records are stored in.
+    bool hash_comp(const BsaAsset * first, const BsaAsset * second);
 
     //Check if a given file is a Tes3-type BSA.
     bool IsBSA(const std::string& path);
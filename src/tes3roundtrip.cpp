@@ -0,0 +1,273 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "libbsa.h"
+
+#include <stdint.h>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+/* Round-trips synthetic Morrowind BSAs through the TES3 reader and writer.
+
+   Usage: libbsa-tes3-roundtrip [workingDir]
+
+   An archive is written byte by byte as Morrowind's tools lay them out, with
+   records in hash order and data in another order. It is then checked that:
+     - saving it without changes reproduces it exactly,
+     - every asset extracts to the data it was written with,
+     - an asset added to it can be extracted once saved and reopened, along
+       with the existing assets, and that archive also resaves exactly.
+   Files are written to a temporary directory unless one is given. Returns 0
+   if every check passes.
+*/
+
+struct SyntheticAsset {
+    string path;    //Windows-1252, as stored.
+    string utf8Path;
+    string data;
+};
+
+//The hash from the format documentation, written out independently of libbsa's.
+uint64_t Tes3Hash(const string& path) {
+    const size_t half = path.length() / 2;
+    uint32_t low = 0;
+    uint32_t high = 0;
+    unsigned off = 0;
+    for (size_t i=0; i < half; i++, off += 8)
+        low ^= (uint32_t)(int32_t)(signed char)path[i] << (off & 0x1F);
+    off = 0;
+    for (size_t i=half; i < path.length(); i++, off += 8) {
+        const uint32_t temp = (uint32_t)(int32_t)(signed char)path[i] << (off & 0x1F);
+        high ^= temp;
+        const unsigned n = temp & 0x1F;
+        high = (high >> n) | (high << ((32 - n) & 0x1F));
+    }
+    return low | ((uint64_t)high << 32);
+}
+
+//Records are sorted by the low half of the hash, then the high half.
+bool RecordOrder(const SyntheticAsset * first, const SyntheticAsset * second) {
+    const uint64_t f = Tes3Hash(first->path);
+    const uint64_t s = Tes3Hash(second->path);
+    if ((uint32_t)f != (uint32_t)s)
+        return (uint32_t)f < (uint32_t)s;
+    return (f >> 32) < (s >> 32);
+}
+
+template<class T>
+void Append(string& out, const T value) {
+    out.append((const char*)&value, sizeof(T));
+}
+
+//Lays out a BSA with the records in hash order and the data in reverse path order.
+string WriteArchive(const vector<SyntheticAsset>& assets) {
+    vector<const SyntheticAsset*> records;
+    for (size_t i=0; i < assets.size(); i++)
+        records.push_back(&assets[i]);
+    sort(records.begin(), records.end(), RecordOrder);
+
+    vector<const SyntheticAsset*> dataOrder(records);
+    sort(dataOrder.begin(), dataOrder.end(), [](const SyntheticAsset * first, const SyntheticAsset * second) {
+        return first->path > second->path;
+    });
+
+    string names, data;
+    vector<uint32_t> nameOffsets, dataOffsets(records.size());
+    for (size_t i=0; i < records.size(); i++) {
+        nameOffsets.push_back(names.length());
+        names += records[i]->path + '\0';
+    }
+    for (size_t i=0; i < dataOrder.size(); i++) {
+        const size_t record = find(records.begin(), records.end(), dataOrder[i]) - records.begin();
+        dataOffsets[record] = data.length();
+        data += dataOrder[i]->data;
+    }
+
+    string out;
+    Append<uint32_t>(out, 0x100);
+    Append<uint32_t>(out, 12 * records.size() + names.length());  //Offset of the hashes from the end of the header.
+    Append<uint32_t>(out, records.size());
+    for (size_t i=0; i < records.size(); i++) {
+        Append<uint32_t>(out, records[i]->data.length());
+        Append<uint32_t>(out, dataOffsets[i]);
+    }
+    for (size_t i=0; i < records.size(); i++)
+        Append<uint32_t>(out, nameOffsets[i]);
+    out += names;
+    for (size_t i=0; i < records.size(); i++)
+        Append<uint64_t>(out, Tes3Hash(records[i]->path));
+    out += data;
+    return out;
+}
+
+string ReadFile(const fs::path& path) {
+    std::ifstream in(path.string().c_str(), std::ios::binary);
+    return string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const fs::path& path, const string& data) {
+    std::ofstream out(path.string().c_str(), std::ios::binary);
+    out.write(data.data(), data.length());
+}
+
+int failures = 0;
+
+void Check(const bool passed, const string& description) {
+    cout << (passed ? "PASS " : "FAIL ") << description << endl;
+    if (!passed)
+        failures++;
+}
+
+//Checks that the BSA at path holds exactly the given assets.
+void CheckContents(const fs::path& path, const vector<SyntheticAsset>& assets) {
+    bsa_handle bh;
+    unsigned int ret = bsa_open(&bh, path.string().c_str());
+    Check(ret == LIBBSA_OK, "open " + path.filename().string());
+    if (ret != LIBBSA_OK)
+        return;
+
+    char ** assetPaths;
+    size_t numAssets;
+    ret = bsa_get_assets(bh, ".+", &assetPaths, &numAssets);
+    Check(ret == LIBBSA_OK && numAssets == assets.size(), "asset count of " + path.filename().string());
+
+    //The stored hashes, whether written above or by libbsa, must match libbsa's.
+    size_t numMismatched, numColliding;
+    ret = bsa_verify_hashes(bh, &assetPaths, &numMismatched, &numColliding);
+    Check(ret == LIBBSA_OK && numMismatched == 0 && numColliding == 0, "hashes in " + path.filename().string());
+
+    for (size_t i=0; i < assets.size(); i++) {
+        uint8_t * data = NULL;
+        size_t size = 0;
+        ret = bsa_extract_asset_to_memory(bh, assets[i].utf8Path.c_str(), &data, &size);
+        Check(ret == LIBBSA_OK && string((const char*)data, size) == assets[i].data, "extract " + assets[i].utf8Path + " from " + path.filename().string());
+        delete [] data;
+    }
+    bsa_close(bh);
+}
+
+//Checks that opening the BSA at path and saving it without changes reproduces it.
+void CheckResave(const fs::path& path, const fs::path& outPath) {
+    bsa_handle bh;
+    unsigned int ret = bsa_open(&bh, path.string().c_str());
+    if (ret == LIBBSA_OK) {
+        ret = bsa_save(bh, outPath.string().c_str(), LIBBSA_VERSION_TES3 | LIBBSA_COMPRESS_LEVEL_0);
+        bsa_close(bh);
+    }
+    Check(ret == LIBBSA_OK && ReadFile(path) == ReadFile(outPath), "unchanged resave of " + path.filename().string() + " is identical");
+}
+
+int main(int argc, char * argv[]) {
+    const fs::path dir = (argc > 1 ? fs::path(argv[1]) : fs::temp_directory_path() / fs::unique_path("libbsa-tes3-%%%%-%%%%"));
+    fs::create_directories(dir);
+
+    //Assets of various sizes, including an empty one and a name outside ASCII.
+    vector<SyntheticAsset> assets;
+    const char * paths[] = {
+        "meshes\\m\\probe_journeyman_01.nif",
+        "meshes\\f\\furn_de_table_01.nif",
+        "textures\\tx_wood_brown.dds",
+        "textures\\menu_icon_none.tga",
+        "icons\\m\\tx_probe_journeyman_01.tga",
+        "sound\\fx\\item\\bookpag1.wav",
+        "bookart\\caf\xe9.dds",
+        "splash\\splash_empty.tga"
+    };
+    const char * utf8Paths[] = {
+        "meshes\\m\\probe_journeyman_01.nif",
+        "meshes\\f\\furn_de_table_01.nif",
+        "textures\\tx_wood_brown.dds",
+        "textures\\menu_icon_none.tga",
+        "icons\\m\\tx_probe_journeyman_01.tga",
+        "sound\\fx\\item\\bookpag1.wav",
+        "bookart\\caf\xc3\xa9.dds",
+        "splash\\splash_empty.tga"
+    };
+    uint32_t seed = 12345;
+    for (size_t i=0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        SyntheticAsset asset;
+        asset.path = paths[i];
+        asset.utf8Path = utf8Paths[i];
+        const size_t size = (i == 7 ? 0 : 1 + (i * 7919) % 5000);
+        for (size_t j=0; j < size; j++) {
+            seed = seed * 1103515245 + 12345;
+            asset.data += (char)(seed >> 16);
+        }
+        assets.push_back(asset);
+    }
+
+    const fs::path original = dir / "synthetic.bsa";
+    WriteFile(original, WriteArchive(assets));
+
+    CheckResave(original, dir / "resaved.bsa");
+    CheckContents(original, assets);
+
+    //Add an asset, save, and check the result as reopened.
+    SyntheticAsset added;
+    added.path = "meshes\\added\\new_asset.nif";
+    added.utf8Path = added.path;
+    added.data = "Data for an asset added after the BSA was written.";
+    const fs::path addedSource = dir / "new_asset.nif";
+    WriteFile(addedSource, added.data);
+
+    const fs::path withAdded = dir / "added.bsa";
+    bsa_handle bh;
+    unsigned int ret = bsa_open(&bh, original.string().c_str());
+    if (ret == LIBBSA_OK) {
+        string sourcePath = addedSource.string();
+        string destPath = "meshes/added/new_asset.nif";
+        bsa_asset asset;
+        asset.sourcePath = &sourcePath[0];
+        asset.destPath = &destPath[0];
+        ret = bsa_add_asset(bh, asset);
+        if (ret == LIBBSA_OK)
+            ret = bsa_save(bh, withAdded.string().c_str(), LIBBSA_VERSION_TES3 | LIBBSA_COMPRESS_LEVEL_0);
+        bsa_close(bh);
+    }
+    Check(ret == LIBBSA_OK, "add an asset and save");
+
+    assets.push_back(added);
+    CheckContents(withAdded, assets);
+    CheckResave(withAdded, dir / "added-resaved.bsa");
+
+    if (argc < 2)
+        fs::remove_all(dir);
+
+    cout << (failures == 0 ? "All checks passed." : "Some checks failed.") << endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -24,11 +24,10 @@
 #ifndef __LIBBSA_TES4STRUCTS_H__
 #define __LIBBSA_TES4STRUCTS_H__
 
-#include "genericbsa.h"
+#include "tes4typebsa.h"
+#include "compression.h"
 #include <stdint.h>
 #include <string>
-#include <boost/filesystem.hpp>
-#include <boost/algorithm/string.hpp>
 
 /* File format infos:
     <http://www.uesp.net/wiki/Tes4Mod:BSA_File_Format>
@@ -38,69 +37,34 @@
 
     This header file defines the constants, structures and functions specific
     to the Tes4-type BSA, which is used by Oblivion, Fallout 3,
-    Fallout: New Vegas and Skyrim.
+    Fallout: New Vegas and Skyrim. The archive engine is shared with
+    Skyrim: Special Edition BSAs, and is in tes4typebsa.h.
 */
 
 namespace libbsa { namespace tes4 {
 
-    const uint32_t BSA_MAGIC = '\0ASB';  //Also for TES5, FO3 and probably FNV too.
     const uint32_t BSA_VERSION_TES4 = 0x67;
     const uint32_t BSA_VERSION_TES5 = 0x68;   //Also for FO3 and probably FNV too.
 
-    const uint32_t BSA_FOLDER_RECORD_OFFSET = 36;  //Folder record offset for TES4-type BSAs is constant.
-
-    const uint32_t BSA_COMPRESSED = 0x0004;  //If this flag is present in the archiveFlags header field, then the BSA file data is compressed.
-
-    const uint32_t FILE_INVERT_COMPRESSED = 0x40000000;  //Inverts the file data compression status for the specific file this flag is set for.
-
-    struct Header {
-        uint32_t fileId;
-        uint32_t version;
-        uint32_t offset;
-        uint32_t archiveFlags;
-        uint32_t folderCount;
-        uint32_t fileCount;
-        uint32_t totalFolderNameLength;
-        uint32_t totalFileNameLength;
-        uint32_t fileFlags;
-    };
-
     struct FolderRecord {
         uint64_t nameHash;  //Hash of folder name.
         uint32_t count;     //Number of files in folder.
         uint32_t offset;    //Offset to the fileRecords for this folder, including the folder name, from the beginning of the file.
     };
 
-    struct FileRecord {
-        uint64_t nameHash;  //Hash of the filename.
-        uint32_t size;      //Size of the data. See TES4Mod wiki page for details.
-        uint32_t offset;    //Offset to the raw file data, from byte 0.
-    };
+    //Format traits for the Tes4-type BSA engine.
+    struct Format {
+        typedef tes4::FolderRecord FolderRecord;
+        typedef DeflateCodec Codec;
 
-    //Tes4-type BSA class.
-    class BSA : public _bsa_handle_int {
-    public:
-        BSA(const std::string& path);
-        void Save(std::string path, const uint32_t version, const uint32_t compression);
-    private:
-        std::pair<uint8_t*,size_t> ReadData(libbsa::ifstream& in, const libbsa::BsaAsset& data);
-
-        uint32_t HashString(const std::string& str);
-        uint64_t CalcHash(const std::string& path, const std::string& ext);
-
-        uint32_t archiveFlags;
-        uint32_t fileFlags;
+        static const char * Name() { return "TES4BSA"; }
+        static bool IsVersion(const uint32_t bsaVersion) { return bsaVersion == BSA_VERSION_TES4 || bsaVersion == BSA_VERSION_TES5; }
+        static uint32_t HeaderVersion(const uint32_t version);
+        static const char * VersionError() { return "Tes4-type BSAs can only be saved as Oblivion or Skyrim BSAs."; }
     };
 
-    bool hash_comp(const BsaAsset& first, const BsaAsset& second);
-
-    //Comparison class for list::unique.
-    class path_comp {
-    public:
-        bool operator() (const BsaAsset& first, const BsaAsset& second) {
-            return first.path == second.path;
-        }
-    };
+    //Tes4-type BSA class.
+    typedef tes4type::BSA<Format> BSA;
 
     //Check if a given file is a Tes4-type BSA.
     bool IsBSA(const std::string& path);
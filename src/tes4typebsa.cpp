@@ -0,0 +1,705 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+// Error C4996 'strcpy': This function or variable may be unsafe.Consider using 
+// strcpy_s instead.  To disable deprecation, use _CRT_SECURE_NO_WARNINGS.
+#define _CRT_SECURE_NO_WARNINGS
+#include "tes4typebsa.h"
+#include "tes4bsa.h"
+#include "ssebsa.h"
+#include "error.h"
+#ifndef _LIBBSA_WRAPPER_MODE
+	#include "libbsa.h"
+#else
+	#include "../cli-windows/libbsa/libwrapper.h"
+#endif
+#include "streams.h"
+#include "hashes.h"
+#include "compression.h"
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <boost/filesystem.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace fs = boost::filesystem;
+
+using namespace std;
+
+namespace libbsa { namespace tes4type {
+
+    template<class Format>
+    BSA<Format>::BSA(const std::string& path)
+        : _bsa_handle_int(path),
+        archiveFlags(0),
+        fileFlags(0) {
+
+        //Check if file exists.
+        if (fs::exists(path)) {
+
+            libbsa::ifstream in(fs::path(path), ios::binary);
+            in.exceptions(ios::failbit | ios::badbit | ios::eofbit);  //Causes ifstream::failure to be thrown if problem is encountered.
+
+            Header header;
+            in.seekg(0, ios_base::beg);
+            in.read((char*)&header, sizeof(Header));
+
+            const string invalid = string(Format::Name()) + ": Structure of \"" + path + "\" is invalid.";
+            if (!Format::IsVersion(header.version) || header.offset != BSA_FOLDER_RECORD_OFFSET)
+                throw error(LIBBSA_ERROR_PARSE_FAIL, invalid);
+
+            //Now we get to the real meat of the file.
+            //Folder records are followed by file records in blocks by folder name, followed by file names.
+            //File records and file names have the same ordering.
+            //The header's sizes are checked against the file's before anything is allocated for them.
+            const uint64_t fileSize = fs::file_size(path);
+            const uint64_t startOfFileRecords = sizeof(Header) + (uint64_t)sizeof(FolderRecord) * header.folderCount;
+            const uint64_t fileRecordsSize =
+                (uint64_t)header.folderCount + //Folder name string length (in 1 byte).
+                header.totalFolderNameLength + //Total length of folder name strings.
+                (uint64_t)sizeof(FileRecord) * header.fileCount;  //Total size of all file records.
+            if (startOfFileRecords + fileRecordsSize + header.totalFileNameLength > fileSize)
+                throw error(LIBBSA_ERROR_PARSE_FAIL, invalid);
+
+            vector<FolderRecord> folderRecords;
+            vector<uint8_t> fileRecords;
+            vector<uint8_t> fileNames;    //A list of null-terminated filenames, one after another.
+            try {
+                folderRecords.resize(header.folderCount);
+                in.read((char*)folderRecords.data(), sizeof(FolderRecord) * header.folderCount);
+
+                fileRecords.resize(fileRecordsSize);
+                in.read((char*)fileRecords.data(), sizeof(uint8_t) * fileRecordsSize);
+
+                fileNames.resize(header.totalFileNameLength);
+                in.read((char*)fileNames.data(), sizeof(uint8_t) * header.totalFileNameLength);
+            } catch (bad_alloc& e) {
+                throw error(LIBBSA_ERROR_NO_MEM, e.what());
+            }
+
+            in.close(); //No longer need the file open.
+
+            /* Loop through the folder records, for each folder looking up the file records associated with it,
+            and the filenames associated with those records. */
+            uint64_t fileNameListPos = 0;
+            for (uint32_t i=0; i < header.folderCount; i++) {
+                /* folderRecords[i].count gives the number of file records associated with this folder.
+                    folderRecords[i].offset gives the offset to the file records associated with this folder,
+                    from the beginning of the file, plus the total filenames length.
+                    folderRecords[i].nameHash is kept for verifying. */
+
+                //Get rid of the extra length first. The folder's records must then be within the file records.
+                const uint64_t folderOffset = (uint64_t)folderRecords[i].offset - header.totalFileNameLength - startOfFileRecords;
+                if ((uint64_t)folderRecords[i].offset < header.totalFileNameLength + startOfFileRecords || folderOffset >= fileRecordsSize)
+                    throw error(LIBBSA_ERROR_PARSE_FAIL, invalid);
+
+                //Need to get folder name to add before file name in internal data store.
+                uint8_t folderNameLength = fileRecords[folderOffset] - 1;
+                const uint64_t startOfFolderFileRecords = folderOffset + folderNameLength + 2;
+                if (startOfFolderFileRecords + (uint64_t)sizeof(FileRecord) * folderRecords[i].count > fileRecordsSize)
+                    throw error(LIBBSA_ERROR_PARSE_FAIL, invalid);
+                string folderName = ToUTF8(string((char*)(fileRecords.data() + folderOffset + 1), folderNameLength));
+                storedFolderHashes.insert(make_pair(folderName, folderRecords[i].nameHash));
+
+                //Now loop through file records for this folder record.
+                for (uint32_t j=0; j < folderRecords[i].count; j++) {
+                    BsaAsset fileData;
+                    FileRecord fr = *(FileRecord*)(fileRecords.data() + startOfFolderFileRecords + j * sizeof(FileRecord));
+                    fileData.hash = fr.nameHash;
+                    fileData.size = fr.size;
+                    fileData.offset = fr.offset;
+                    if (fileData.offset + StoredSize(fileData) > fileSize || fileNameListPos >= fileNames.size())
+                        throw error(LIBBSA_ERROR_PARSE_FAIL, invalid);
+
+                    //Now we need to build the file path. First: file name.
+                    const char * filenameStart = (const char*)(fileNames.data() + fileNameListPos);
+                    //Find position of null pointer, which must be within the file names.
+                    const char * nptr = (const char*)memchr(filenameStart, '\0', fileNames.size() - fileNameListPos);
+                    if (nptr == NULL)
+                        throw error(LIBBSA_ERROR_PARSE_FAIL, invalid);
+
+                    fileData.path += ToUTF8(string(filenameStart, nptr - filenameStart));
+                    fileNameListPos += nptr - filenameStart + 1;  //The stored length, which may differ from the UTF-8 path's.
+
+                    if (!folderName.empty())
+                        fileData.path = folderName + '\\' + fileData.path;
+
+                    //Finally, add file path and object to list.
+                    assets.push_back(fileData);
+                }
+            }
+
+            //Record the file and archive flags.
+            fileFlags = header.fileFlags;
+            archiveFlags = header.archiveFlags;
+        } else
+            archiveFlags = BSA_FOLDER_NAMES | BSA_FILE_NAMES;  //A new BSA.
+    }
+
+    template<class Format>
+    void BSA<Format>::Save(std::string path, const uint32_t version, const uint32_t compression) {
+                //Version and compression have been validated.
+
+        const uint32_t bsaVersion = Format::HeaderVersion(version);
+        if (bsaVersion == 0)
+            throw error(LIBBSA_ERROR_INVALID_ARGS, Format::VersionError());
+
+        //The archive is written to a temporary file that replaces the one at path once complete, so it's
+        //safe to save over the file being read from, and a failed save leaves any existing file intact.
+        AtomicFile file(path);
+        libbsa::fstream& out = file.Stream();
+        out.exceptions(ios::failbit | ios::badbit | ios::eofbit);  //Causes ifstream::failure to be thrown if problem is encountered.
+
+        ///////////////////////////////
+        // Set header up
+        ///////////////////////////////
+
+        Header header;
+
+        header.fileId = BSA_MAGIC;
+
+        header.version = bsaVersion;
+
+        header.offset = 36;
+
+        header.archiveFlags = archiveFlags;
+        if (compression != LIBBSA_COMPRESS_LEVEL_NOCHANGE) {
+            if (compression == LIBBSA_COMPRESS_LEVEL_0 && header.archiveFlags & BSA_COMPRESSED)
+                header.archiveFlags ^= BSA_COMPRESSED;
+            else if (compression != LIBBSA_COMPRESS_LEVEL_0 && !(header.archiveFlags & BSA_COMPRESSED))
+                header.archiveFlags |= BSA_COMPRESSED;
+        }
+
+        header.fileFlags = fileFlags;
+
+        vector<LayoutEntry> layout;
+        RecordTables tables;
+        BuildRecords(header, layout, tables);
+
+        ////////////////////////
+        // Write out
+        ////////////////////////
+
+        WriteRecords(out, header, tables);
+
+        //Now write out file data, in the same order as the FileRecordBlocks unless another data order is set.
+        //Without a compression level change the stored data is copied as-is, otherwise each
+        //asset is decompressed as necessary and then recompressed on the worker pool.
+        //Added assets are packed from their external files, and merged assets are copied from their BSAs.
+        const int level = CompressionLevel(compression);
+        const bool compressed = (header.archiveFlags & BSA_COMPRESSED) != 0;
+        boost::unordered_map<string, const string*> pendingSources;
+        GetPendingSources(pendingSources);
+        vector<size_t> order;
+        GetLayoutDataOrder(layout, order);
+        vector<SaveBlock> blocks;
+        blocks.reserve(layout.size());
+        for (size_t k=0, max=order.size(); k < max; k++) {
+            //The layout points straight at the asset, so its stored data is found without searching.
+            BsaAsset& source = *layout[order[k]].asset;
+
+            boost::unordered_map<string, const string*>::const_iterator pendingIt = pendingSources.find(source.path);
+            if (pendingIt != pendingSources.end()) {
+                blocks.push_back(PendingBlock(source, *pendingIt->second, compressed, FILE_INVERT_COMPRESSED - 1));
+                continue;
+            }
+            boost::unordered_map<string, MergedAsset>::const_iterator mergedIt = mergedAssets.find(source.path);
+            if (mergedIt != mergedAssets.end()) {
+                blocks.push_back(MergedBlock(source, mergedIt->second, level));
+                continue;
+            }
+
+            SaveBlock block;
+            block.source = &source;
+            block.size = source.size & ~FILE_INVERT_COMPRESSED;
+            if (level == 0)
+                block.transcode = IsCompressed(source);
+            else if (level > 0) {
+                //Formats that are already compressed are stored uncompressed without trying.
+                block.compress = !IsIncompressibleFormat(source.path);
+                block.transcode = block.compress || IsCompressed(source);
+            }
+            blocks.push_back(block);
+        }
+
+        //When keeping the existing compression, added assets are compressed at the highest level.
+        WriteBlocks(out, file.Handle(), blocks, level < 0 ? 9 : level);
+
+        //Now that the data sizes and offsets are known, fill them in and rewrite the file record blocks.
+        for (size_t k=0, max=blocks.size(); k < max; k++)
+            SetFileRecord(tables, order[k], RecordSize(blocks[k], compressed), blocks[k].offset);
+
+        out.seekp(sizeof(Header) + sizeof(FolderRecord) * header.folderCount, ios_base::beg);
+        out.write((char*)tables.fileRecordBlocks.data(), tables.fileRecordBlocks.size());
+
+        file.Commit();
+
+        //Update member vars.
+        UpdateAssets(layout, tables);
+        filePath = path;
+        archiveFlags = header.archiveFlags;
+        fileFlags = header.fileFlags;
+    }
+
+    template<class Format>
+    void BSA<Format>::SaveIncremental() {
+        if (!fs::exists(filePath))
+            throw error(LIBBSA_ERROR_INVALID_ARGS, "\"" + filePath + "\" does not exist, so cannot be saved incrementally.");
+
+        libbsa::fstream file(fs::path(filePath), ios::binary | ios::in | ios::out);
+        file.exceptions(ios::failbit | ios::badbit | ios::eofbit);  //Causes ifstream::failure to be thrown if problem is encountered.
+
+        //The file is truncated back to this size if the save fails.
+        file.seekg(0, ios_base::end);
+        const uint64_t originalSize = file.tellg();
+        file.seekg(0, ios_base::beg);
+
+        //Keep the existing version and flags.
+        Header header;
+        file.read((char*)&header, sizeof(Header));
+        header.archiveFlags = archiveFlags;
+        header.fileFlags = fileFlags;
+
+        vector<LayoutEntry> layout;
+        RecordTables tables;
+        BuildRecords(header, layout, tables);
+
+        //Existing data stays where it is, unless the new records would overwrite it. That data and
+        //the added assets are appended to the file, leaving gaps where moved and removed data was.
+        const uint64_t recordsEnd = sizeof(Header) + sizeof(FolderRecord) * tables.folderRecords.size() + tables.fileRecordBlocks.size() + tables.fileNames.size();
+        const bool compressed = (header.archiveFlags & BSA_COMPRESSED) != 0;
+        boost::unordered_map<string, const string*> pendingSources;
+        GetPendingSources(pendingSources);
+        vector<size_t> order;
+        GetLayoutDataOrder(layout, order);
+        vector<SaveBlock> blocks;
+        vector<size_t> blockEntries;  //The layout entry for each block.
+        for (size_t k=0, max=order.size(); k < max; k++) {
+            const size_t j = order[k];
+            BsaAsset& source = *layout[j].asset;
+
+            boost::unordered_map<string, const string*>::const_iterator pendingIt = pendingSources.find(source.path);
+            boost::unordered_map<string, MergedAsset>::const_iterator mergedIt = mergedAssets.find(source.path);
+            if (pendingIt != pendingSources.end())
+                blocks.push_back(PendingBlock(source, *pendingIt->second, compressed, FILE_INVERT_COMPRESSED - 1));
+            else if (mergedIt != mergedAssets.end())
+                blocks.push_back(MergedBlock(source, mergedIt->second, -1));
+            else if (source.offset < recordsEnd) {
+                SaveBlock block;
+                block.source = &source;
+                block.size = source.size & ~FILE_INVERT_COMPRESSED;
+                blocks.push_back(block);
+            } else {
+                SetFileRecord(tables, j, source.size, source.offset);
+                continue;
+            }
+            blockEntries.push_back(j);
+        }
+
+        //File records can't address data beyond 4 GB, so check that the appended data will fit before writing any of it.
+        //Transcoded blocks' sizes aren't known until they're written, so only the data copied unchanged is counted, and
+        //the offsets are checked again once known.
+        uint64_t minEnd = originalSize;
+        for (size_t k=0, max=blocks.size(); k < max; k++) {
+            if (minEnd > UINT32_MAX)
+                throw error(LIBBSA_ERROR_INVALID_ARGS, "The BSA's asset data is too large: file records can't address data beyond 4 GB.");
+            if (!blocks[k].transcode)
+                minEnd += blocks[k].size;
+        }
+
+        //The records that will be overwritten are kept, so that they can be put back if the save fails.
+        vector<char> originalRecords(recordsEnd < originalSize ? recordsEnd : originalSize);
+        file.seekg(0, ios_base::beg);
+        file.read(originalRecords.data(), originalRecords.size());
+
+        try {
+            file.seekp(0, ios_base::end);
+            WriteBlocks(file, file->handle(), blocks, 9);
+
+            for (size_t k=0, max=blocks.size(); k < max; k++)
+                SetFileRecord(tables, blockEntries[k], RecordSize(blocks[k], compressed), blocks[k].offset);
+
+            //The records are written last, so the old ones stay valid until all the data is in place.
+            //Syncing the data first makes sure it reaches the disk before the records that point to it.
+            file.flush();
+            SyncFile(file->handle());
+            file.seekp(0, ios_base::beg);
+            WriteRecords(file, header, tables);
+            file.flush();
+            SyncFile(file->handle());
+
+            file.close();
+        } catch (...) {
+            //Put back the old records and remove the appended data, so that the BSA is left as it was. This is
+            //done as far as possible, as whatever caused the failure may also stop it succeeding.
+            try {
+                file.clear();
+                file.seekp(0, ios_base::beg);
+                file.write(originalRecords.data(), originalRecords.size());
+                file.close();
+                fs::resize_file(filePath, originalSize);
+            } catch (...) {}
+            throw;
+        }
+
+        UpdateAssets(layout, tables);
+    }
+
+    template<class Format>
+    void BSA<Format>::BuildRecords(Header& header, std::vector<LayoutEntry>& layout, RecordTables& tables) {
+        //Split each asset's path into its folder and filename once, then sort by folder hash and file hash.
+        //Each folder's files are then contiguous and in the order their records must be written.
+        layout.clear();
+        layout.reserve(assets.size());
+        boost::unordered_map<string, uint64_t> folderHashes;
+        for (list<BsaAsset>::iterator it = assets.begin(), endIt = assets.end(); it != endIt; ++it) {
+            LayoutEntry entry;
+
+            //Transcode paths.
+            string assetPath = FromUTF8(it->path);
+            size_t pos = assetPath.rfind('\\');
+            if (pos == string::npos)
+                entry.filename = assetPath;
+            else {
+                entry.folder = assetPath.substr(0, pos);
+                entry.filename = assetPath.substr(pos + 1);
+            }
+
+            boost::unordered_map<string, uint64_t>::iterator hashIt = folderHashes.find(entry.folder);
+            if (hashIt == folderHashes.end())
+                hashIt = folderHashes.insert(make_pair(entry.folder, Tes4Hash(entry.folder.data(), entry.folder.length(), NULL, 0))).first;
+            entry.folderHash = hashIt->second;
+            entry.fileHash = it->hash;
+            entry.asset = &*it;
+
+            layout.push_back(entry);
+        }
+        sort(layout.begin(), layout.end(), layout_comp);
+
+        header.folderCount = 0;
+        header.fileCount = layout.size();
+        header.totalFolderNameLength = 0;
+        header.totalFileNameLength = 0;
+        for (size_t j=0, max=layout.size(); j < max; j++) {
+            if (j == 0 || layout[j].folder != layout[j-1].folder) {
+                header.folderCount++;
+                header.totalFolderNameLength += layout[j].folder.length() + 1;
+            }
+            header.totalFileNameLength += layout[j].filename.length() + 1;
+        }
+
+        /////////////////////////////
+        // Set folder record array
+        /////////////////////////////
+
+        /* Iterate through the sorted layout.
+           At the start of each folder's run of files, write out the folder's hash and the offset of its file records,
+           then the length of the folder name and the folder name.
+           For each file, write out its nameHash, leaving its size and offset to be filled in once its data has been written.
+           The folder's count is the length of its run.
+        */
+
+        try {
+            tables.folderRecords.assign(header.folderCount, FolderRecord());
+            tables.fileRecordBlocks.assign(header.folderCount + header.totalFolderNameLength + header.fileCount * sizeof(FileRecord), 0);
+            tables.fileNames.assign(header.totalFileNameLength, 0);
+            tables.fileRecordPositions.clear();
+            tables.fileRecordPositions.reserve(layout.size());
+        } catch (bad_alloc& e) {
+            throw error(LIBBSA_ERROR_NO_MEM, e.what());
+        }
+
+        uint32_t startOfFileRecordBlock = sizeof(Header) + header.folderCount * sizeof(FolderRecord) + header.totalFileNameLength;  //For some reason offsets include this.
+        uint32_t i = 0;
+        uint32_t currFileRecordBlockPos = 0;
+        uint32_t currFileNamePos = 0;
+        for (size_t j=0, max=layout.size(); j < max; j++) {
+            if (j == 0 || layout[j].folder != layout[j-1].folder) {
+                if (j > 0)
+                    i++;
+
+                //Write folder hash and offset, count files as they're written.
+                tables.folderRecords[i].nameHash = layout[j].folderHash;
+                tables.folderRecords[i].count = 0;
+                tables.folderRecords[i].offset = startOfFileRecordBlock + currFileRecordBlockPos;
+
+                //Write folder name length, folder name to fileRecordBlocks buffer.
+                uint8_t nameLength = layout[j].folder.length() + 1;
+                tables.fileRecordBlocks[currFileRecordBlockPos] = nameLength;
+                currFileRecordBlockPos++;
+                memcpy(&tables.fileRecordBlocks[currFileRecordBlockPos], layout[j].folder.c_str(), nameLength);
+                currFileRecordBlockPos += nameLength;
+            }
+
+            //Write file hash to fileRecordBlocks stream. The size and offset are filled in once the data has been written.
+            tables.fileRecordPositions.push_back(currFileRecordBlockPos);
+            FileRecord fr;
+            fr.nameHash = layout[j].fileHash;
+            fr.size = 0;
+            fr.offset = 0;
+            memcpy(&tables.fileRecordBlocks[currFileRecordBlockPos], &fr, sizeof(FileRecord));
+            currFileRecordBlockPos += sizeof(FileRecord);
+            //Increment count.
+            tables.folderRecords[i].count++;
+            //Also write out filename to fileNameBlock.
+            memcpy(&tables.fileNames[currFileNamePos], layout[j].filename.c_str(), layout[j].filename.length() + 1);
+            currFileNamePos += layout[j].filename.length() + 1;
+        }
+    }
+
+    template<class Format>
+    void BSA<Format>::WriteRecords(std::ostream& out, const Header& header, const RecordTables& tables) {
+        out.write((char*)&header, sizeof(Header));
+        out.write((char*)tables.folderRecords.data(), sizeof(FolderRecord) * tables.folderRecords.size());
+        out.write((char*)tables.fileRecordBlocks.data(), tables.fileRecordBlocks.size());
+        out.write((char*)tables.fileNames.data(), tables.fileNames.size());
+    }
+
+    template<class Format>
+    void BSA<Format>::SetFileRecord(RecordTables& tables, const size_t entry, const uint64_t size, const uint64_t offset) {
+        //File records hold 32-bit offsets, so data can't start beyond 4 GB into the file.
+        if (offset > UINT32_MAX)
+            throw error(LIBBSA_ERROR_INVALID_ARGS, "The BSA's asset data is too large: file records can't address data beyond 4 GB.");
+        if (size > UINT32_MAX)
+            throw error(LIBBSA_ERROR_INVALID_ARGS, "An asset's data is too large: file records hold 32-bit sizes.");
+
+        FileRecord * fr = (FileRecord*)&tables.fileRecordBlocks[tables.fileRecordPositions[entry]];
+        fr->size = size;
+        fr->offset = offset;
+    }
+
+    template<class Format>
+    uint64_t BSA<Format>::RecordSize(const SaveBlock& block, const bool compressed) const {
+        //The size shares its field with the invert flag, so it must be below it.
+        if (block.size >= FILE_INVERT_COMPRESSED)
+            throw error(LIBBSA_ERROR_INVALID_ARGS, "An asset's data is too large: file records can't hold sizes of 1 GB or more.");
+
+        //Copied data keeps its compression status.
+        bool storedCompressed;
+        if (block.transcode || block.merged != NULL)
+            storedCompressed = block.compress;
+        else
+            storedCompressed = block.externalPath == NULL && IsCompressed(*block.source);
+
+        if (storedCompressed != compressed)
+            return block.size | FILE_INVERT_COMPRESSED;
+        return block.size;
+    }
+
+    template<class Format>
+    void BSA<Format>::GetLayoutDataOrder(const std::vector<LayoutEntry>& layout, std::vector<size_t>& order) const {
+        vector<const BsaAsset*> records(layout.size());
+        for (size_t j=0, max=layout.size(); j < max; j++)
+            records[j] = layout[j].asset;
+        GetDataOrder(records, order);
+    }
+
+    template<class Format>
+    void BSA<Format>::UpdateAssets(const std::vector<LayoutEntry>& layout, const RecordTables& tables) {
+        //Point the assets at their new data.
+        for (size_t j=0, max=layout.size(); j < max; j++) {
+            const FileRecord * fr = (const FileRecord*)&tables.fileRecordBlocks[tables.fileRecordPositions[j]];
+            layout[j].asset->size = fr->size;
+            layout[j].asset->offset = fr->offset;
+        }
+        pendingAssets.clear();
+        mergedAssets.clear();
+        storedFolderHashes.clear();  //The folder records were written with the hashes of their paths.
+    }
+
+    template<class Format>
+    _bsa_handle_int * BSA<Format>::CreateEmpty() const {
+        BSA * bsa = new BSA("");
+        bsa->archiveFlags = archiveFlags;
+        bsa->fileFlags = fileFlags;
+        return bsa;
+    }
+
+    template<class Format>
+    uint64_t BSA<Format>::HashPath(const std::string& assetPath) {
+        const string path = FromUTF8(assetPath);
+        return Tes4FileHash(path.data(), path.length());
+    }
+
+    template<class Format>
+    void BSA<Format>::HashPaths(const std::vector<const std::string*>& assetPaths, std::vector<uint64_t>& hashes) {
+        //The paths are converted into one buffer, one after another, and hashed together.
+        string names, path;
+        vector<size_t> offsets(1, 0);
+        offsets.reserve(assetPaths.size() + 1);
+        for (size_t i=0, max=assetPaths.size(); i < max; i++) {
+            FromUTF8(*assetPaths[i], path);
+            names += path;
+            offsets.push_back(names.length());
+        }
+        hashes.resize(assetPaths.size());
+        Tes4FileHashes(names.data(), offsets.data(), assetPaths.size(), hashes.data());
+    }
+
+    template<class Format>
+    uint64_t BSA<Format>::StoredSize(const BsaAsset& asset) const {
+        return asset.size & ~FILE_INVERT_COMPRESSED;
+    }
+
+    template<class Format>
+    bool BSA<Format>::IsCompressed(const BsaAsset& data) const {
+        return ((archiveFlags & BSA_COMPRESSED) != 0) != ((data.size & FILE_INVERT_COMPRESSED) != 0);
+    }
+
+    template<class Format>
+    bool BSA<Format>::CanCopyStoredDataFrom(const _bsa_handle_int& other) const {
+        return dynamic_cast<const BSA*>(&other) != NULL;
+    }
+
+    template<class Format>
+    void BSA<Format>::VerifyIndexHashes(const std::vector<const BsaAsset*>& checked, const std::vector<const std::string*>& hashedPaths, HashReport& report) {
+        //Assets are looked up by their folder's hash, then by their own hash within the folder, so folders
+        //with the same hash collide as a whole, and files collide if they have the same hash in the same folder.
+        struct FolderCheck {
+            uint64_t storedHash;
+            uint64_t hash;
+            bool collides;
+        };
+        boost::unordered_map<string, FolderCheck> folders;  //By path, as stored.
+        vector<const FolderCheck*> assetFolders(checked.size());
+        const string * lastFolder = NULL;  //Assets read from the BSA are grouped by folder, so most are in the same folder as the asset before.
+        string folder;
+        for (size_t i=0, max=checked.size(); i < max; i++) {
+            const string& path = checked[i]->path;
+            const size_t pos = path.rfind('\\');
+            const size_t folderLength = (pos == string::npos ? 0 : pos);
+            if (lastFolder == NULL || lastFolder->length() != folderLength || path.compare(0, folderLength, *lastFolder) != 0) {
+                folder.assign(path, 0, folderLength);
+                typename boost::unordered_map<string, FolderCheck>::iterator it = folders.find(folder);
+                if (it == folders.end()) {
+                    //Normalising a path doesn't change the length of its folder.
+                    const string hashedFolder = FromUTF8(hashedPaths[i]->substr(0, folderLength));
+                    FolderCheck check;
+                    check.hash = Tes4Hash(hashedFolder.data(), hashedFolder.length(), NULL, 0);
+                    check.collides = false;
+
+                    boost::unordered_map<string, uint64_t>::const_iterator storedIt = storedFolderHashes.find(folder);
+                    if (storedIt != storedFolderHashes.end())
+                        check.storedHash = storedIt->second;
+                    else {
+                        const string storedFolder = FromUTF8(folder);
+                        check.storedHash = Tes4Hash(storedFolder.data(), storedFolder.length(), NULL, 0);
+                    }
+                    it = folders.insert(make_pair(folder, check)).first;
+                }
+                lastFolder = &it->first;
+                assetFolders[i] = &it->second;
+            } else
+                assetFolders[i] = assetFolders[i - 1];
+
+            if (assetFolders[i]->storedHash != assetFolders[i]->hash)
+                report.mismatched.push_back(path);
+        }
+
+        vector< pair<uint64_t, FolderCheck*> > folderKeys;
+        folderKeys.reserve(folders.size());
+        for (typename boost::unordered_map<string, FolderCheck>::iterator it = folders.begin(), endIt = folders.end(); it != endIt; ++it)
+            folderKeys.push_back(make_pair(it->second.storedHash, &it->second));
+        sort(folderKeys.begin(), folderKeys.end());
+        for (size_t i=0, max=folderKeys.size(); i < max; i++) {
+            if ((i > 0 && folderKeys[i].first == folderKeys[i - 1].first) || (i + 1 < max && folderKeys[i].first == folderKeys[i + 1].first))
+                folderKeys[i].second->collides = true;
+        }
+
+        //Each asset's folder's stored hash and its own, with its index.
+        vector< pair<pair<uint64_t, uint64_t>, size_t> > keys(checked.size());
+        for (size_t i=0, max=checked.size(); i < max; i++) {
+            if (assetFolders[i]->collides)
+                report.colliding.push_back(checked[i]->path);
+            keys[i] = make_pair(make_pair(assetFolders[i]->storedHash, checked[i]->hash), i);
+        }
+        if (!is_sorted(keys.begin(), keys.end()))  //Assets read from the BSA are already in record order.
+            sort(keys.begin(), keys.end());
+        for (size_t i=0, max=keys.size(); i < max; i++) {
+            if ((i > 0 && keys[i].first == keys[i - 1].first) || (i + 1 < max && keys[i].first == keys[i + 1].first))
+                report.colliding.push_back(checked[keys[i].second]->path);
+        }
+    }
+
+    template<class Format>
+    void BSA<Format>::EncodeData(const uint8_t * data, const size_t size, const int level, std::vector<uint8_t>& out) {
+        //Compressed data is prefixed by its uncompressed size.
+        const uint32_t uncompressedSize = size;
+        Format::Codec::Deflate(data, size, level, out);
+        out.insert(out.begin(), (const uint8_t*)&uncompressedSize, (const uint8_t*)&uncompressedSize + sizeof(uint32_t));
+    }
+
+    template<class Format>
+    std::pair<uint8_t*,size_t> BSA<Format>::ReadData(libbsa::ifstream& in, const libbsa::BsaAsset& data) {
+        uint8_t * outBuffer = NULL;
+        size_t outSize = StoredSize(data);  //Without the compression flag.
+        //Check if given file is compressed or not. If not, can ofstream straight to path, otherwise need to involve the format's codec.
+        if (!IsCompressed(data)) {
+            try {
+                outBuffer = new uint8_t[outSize];
+            } catch (bad_alloc& e) {
+                throw error(LIBBSA_ERROR_NO_MEM, e.what());
+            }
+
+            ReadStoredData(in, data.offset, outBuffer, outSize);
+        } else {
+            //Use the format's codec.
+            //Get the uncompressed size.
+            uint32_t uncompressedSize;
+            in.seekg(data.offset, ios_base::beg);
+            in.read((char*)&uncompressedSize, sizeof(uint32_t));
+
+            //in is now at the start of the compressed data, and we have the compressed and uncompressed size.
+            outSize -= sizeof(uint32_t);  //First uint32_t of data is the size of the uncompressed data.
+            try {
+                outBuffer = new uint8_t[uncompressedSize];
+            } catch (bad_alloc& e) {
+                throw error(LIBBSA_ERROR_NO_MEM, e.what());
+            }
+
+            //Inflate straight from the file into the output buffer.
+            try {
+                Format::Codec::Inflate(in, outSize, outBuffer, uncompressedSize, data.path);
+            } catch (...) {
+                delete [] outBuffer;
+                throw;
+            }
+
+            outSize = uncompressedSize;
+        }
+
+        return pair<uint8_t*,size_t>(outBuffer, outSize);
+    }
+
+    bool layout_comp(const LayoutEntry& first, const LayoutEntry& second) {
+        if (first.folderHash != second.folderHash)
+            return first.folderHash < second.folderHash;
+        if (first.folder != second.folder)
+            return first.folder < second.folder;  //Keep folders with colliding hashes apart.
+        return first.fileHash < second.fileHash;
+    }
+
+    //The engine is compiled once for each format here.
+    template class BSA<tes4::Format>;
+    template class BSA<sse::Format>;
+} }
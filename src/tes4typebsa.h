@@ -0,0 +1,138 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __LIBBSA_TES4TYPEBSA_H__
+#define __LIBBSA_TES4TYPEBSA_H__
+
+#include "genericbsa.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* File format infos:
+    <http://www.uesp.net/wiki/Tes4Mod:BSA_File_Format>
+    <http://www.uesp.net/wiki/Tes5Mod:Archive_File_Format>
+
+    This header file defines the constants, structures and the archive engine
+    shared by the Tes4-type BSA formats, which are used by Oblivion, Fallout 3,
+    Fallout: New Vegas, Skyrim and Skyrim: Special Edition. The formats only
+    differ in their versions, folder record layout and compression codec,
+    which each format gives as a traits class (see tes4bsa.h and ssebsa.h).
+*/
+
+namespace libbsa { namespace tes4type {
+
+    const uint32_t BSA_MAGIC = '\0ASB';
+
+    const uint32_t BSA_FOLDER_RECORD_OFFSET = 36;  //Folder record offset for Tes4-type BSAs is constant.
+
+    const uint32_t BSA_FOLDER_NAMES = 0x0001;  //Folder names are stored. Always set by the games' BSAs.
+    const uint32_t BSA_FILE_NAMES = 0x0002;    //File names are stored. Always set by the games' BSAs.
+    const uint32_t BSA_COMPRESSED = 0x0004;  //If this flag is present in the archiveFlags header field, then the BSA file data is compressed.
+
+    const uint32_t FILE_INVERT_COMPRESSED = 0x40000000;  //Inverts the file data compression status for the specific file this flag is set for.
+
+    struct Header {
+        uint32_t fileId;
+        uint32_t version;
+        uint32_t offset;
+        uint32_t archiveFlags;
+        uint32_t folderCount;
+        uint32_t fileCount;
+        uint32_t totalFolderNameLength;
+        uint32_t totalFileNameLength;
+        uint32_t fileFlags;
+    };
+
+    struct FileRecord {
+        uint64_t nameHash;  //Hash of the filename.
+        uint32_t size;      //Size of the data. See TES4Mod wiki page for details.
+        uint32_t offset;    //Offset to the raw file data, from byte 0.
+    };
+
+    //An asset's place in the record layout, with its Windows-1252 path split into folder and filename.
+    struct LayoutEntry {
+        uint64_t folderHash;
+        uint64_t fileHash;
+        std::string folder;
+        std::string filename;
+        BsaAsset * asset;
+    };
+
+    /* Tes4-type BSA class, for the format given by Format. Format is a traits class with:
+
+        FolderRecord                The folder record structure, with nameHash, count and offset members.
+        Codec                       The codec used for compressed data (see compression.h).
+        Name()                      The format's name, for error messages.
+        IsVersion(bsaVersion)       Whether a header version is one of the format's.
+        HeaderVersion(version)      The header version to save a LIBBSA_VERSION_* as, or 0 if the format can't be saved as it.
+        VersionError()              The error message for saving as a version that the format can't be saved as.
+
+       The engine is only compiled for the supported formats, in tes4typebsa.cpp.
+    */
+    template<class Format>
+    class BSA : public _bsa_handle_int {
+    public:
+        typedef typename Format::FolderRecord FolderRecord;
+
+        //The folder records, file record blocks and file names, as they are stored.
+        struct RecordTables {
+            std::vector<FolderRecord> folderRecords;
+            std::vector<uint8_t> fileRecordBlocks;
+            std::vector<uint8_t> fileNames;
+            std::vector<uint32_t> fileRecordPositions;  //Where each layout entry's file record is in fileRecordBlocks.
+        };
+
+        BSA(const std::string& path);
+        void Save(std::string path, const uint32_t version, const uint32_t compression);
+        void SaveIncremental();
+    protected:
+        _bsa_handle_int * CreateEmpty() const;
+        uint64_t HashPath(const std::string& assetPath);
+        void HashPaths(const std::vector<const std::string*>& assetPaths, std::vector<uint64_t>& hashes);
+        void VerifyIndexHashes(const std::vector<const libbsa::BsaAsset*>& checked, const std::vector<const std::string*>& hashedPaths, libbsa::HashReport& report);
+        void EncodeData(const uint8_t * data, const size_t size, const int level, std::vector<uint8_t>& out);
+        uint64_t StoredSize(const libbsa::BsaAsset& asset) const;
+        bool IsCompressed(const libbsa::BsaAsset& data) const;  //Takes the archive's default and the asset's invert flag into account.
+        bool CanCopyStoredDataFrom(const _bsa_handle_int& other) const;  //Only BSAs of the same format share a codec.
+    private:
+        std::pair<uint8_t*,size_t> ReadData(libbsa::ifstream& in, const libbsa::BsaAsset& data);
+
+        //Lays out the records for the current assets, with zero sizes and offsets, and sets the header's counts and name lengths.
+        void BuildRecords(Header& header, std::vector<LayoutEntry>& layout, RecordTables& tables);
+        void WriteRecords(std::ostream& out, const Header& header, const RecordTables& tables);
+        void SetFileRecord(RecordTables& tables, const size_t entry, const uint64_t size, const uint64_t offset);
+        uint64_t RecordSize(const libbsa::SaveBlock& block, const bool compressed) const;  //The stored size of a written block, including any invert flag.
+        void GetLayoutDataOrder(const std::vector<LayoutEntry>& layout, std::vector<size_t>& order) const;  //The layout indices in the order their data should be written.
+        void UpdateAssets(const std::vector<LayoutEntry>& layout, const RecordTables& tables);  //Sets the assets' sizes and offsets from their records.
+
+        uint32_t archiveFlags;
+        uint32_t fileFlags;
+        boost::unordered_map<std::string, uint64_t> storedFolderHashes;  //The hashes stored for the folders read from the BSA file, by path. Other folders' hashes are those of their paths.
+    };
+
+    //Orders by folder hash, then file hash, as records are stored.
+    bool layout_comp(const LayoutEntry& first, const LayoutEntry& second);
+} }
+
+#endif
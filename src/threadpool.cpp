@@ -0,0 +1,138 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+#include "threadpool.h"
+
+using namespace std;
+
+namespace libbsa {
+
+    ThreadPool::ThreadPool(size_t threadCount) : runningTasks(0), stopping(false) {
+        if (threadCount == 0)
+            threadCount = thread::hardware_concurrency();
+        if (threadCount == 0)  //hardware_concurrency() may not be able to tell.
+            threadCount = 1;
+
+        for (size_t i=0; i < threadCount; i++)
+            workers.push_back(thread(&ThreadPool::Work, this));
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        taskQueued.notify_all();
+
+        for (size_t i=0, max=workers.size(); i < max; i++)
+            workers[i].join();
+    }
+
+    void ThreadPool::Submit(const std::function<void()>& task) {
+        {
+            lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(task);
+        }
+        taskQueued.notify_one();
+    }
+
+    void ThreadPool::Wait() {
+        unique_lock<std::mutex> lock(mutex);
+        while (!tasks.empty() || runningTasks > 0)
+            tasksFinished.wait(lock);
+    }
+
+    size_t ThreadPool::Size() const {
+        return workers.size();
+    }
+
+    ThreadPool& ThreadPool::Shared() {
+        //Deliberately leaked: destroying it would join its threads during static destruction, which deadlocks when
+        //the library is unloaded on Windows. Its threads are idle by then, so they end with the process.
+        static ThreadPool * pool = new ThreadPool();
+        return *pool;
+    }
+
+    void ThreadPool::Work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                unique_lock<std::mutex> lock(mutex);
+                while (!stopping && tasks.empty())
+                    taskQueued.wait(lock);
+
+                //Queued tasks are still run when stopping, so that nothing submitted is lost.
+                if (tasks.empty())
+                    return;
+
+                task = tasks.front();
+                tasks.pop_front();
+                runningTasks++;
+            }
+
+            task();
+
+            {
+                lock_guard<std::mutex> lock(mutex);
+                runningTasks--;
+                if (tasks.empty() && runningTasks == 0)
+                    tasksFinished.notify_all();
+            }
+        }
+    }
+
+    TaskGroup::TaskGroup() : pendingTasks(0) {}
+
+    TaskGroup::~TaskGroup() {
+        Wait();
+    }
+
+    void TaskGroup::Submit(const std::function<void()>& task) {
+        {
+            lock_guard<std::mutex> lock(mutex);
+            pendingTasks++;
+        }
+
+        try {
+            ThreadPool::Shared().Submit([this, task]() {
+                task();
+
+                //Notified with the lock held, as the group may be destroyed as soon as a waiter sees no pending tasks.
+                lock_guard<std::mutex> lock(mutex);
+                if (--pendingTasks == 0)
+                    tasksFinished.notify_all();
+            });
+        } catch (...) {
+            lock_guard<std::mutex> lock(mutex);
+            if (--pendingTasks == 0)
+                tasksFinished.notify_all();
+            throw;
+        }
+    }
+
+    void TaskGroup::Wait() {
+        unique_lock<std::mutex> lock(mutex);
+        while (pendingTasks > 0)
+            tasksFinished.wait(lock);
+    }
+}
@@ -0,0 +1,80 @@
+/*  libbsa
+
+    A library for reading and writing BSA files.
+
+    Copyright (C) 2012-2013    WrinklyNinja
+
+    This file is part of libbsa.
+
+    libbsa is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    libbsa is distributed in the hope that it will
+    be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libbsa.  If not, see
+    <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __LIBBSA_THREADPOOL_H__
+#define __LIBBSA_THREADPOOL_H__
+
+#include <stddef.h>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace libbsa {
+
+    //Fixed-size pool of worker threads that run queued tasks in submission order.
+    //Tasks must not throw: any exceptions should be caught and reported by the task itself.
+    class ThreadPool {
+    public:
+        ThreadPool(size_t threadCount = 0);  //0 uses one thread per hardware thread.
+        ~ThreadPool();  //Finishes all queued tasks before returning.
+
+        void Submit(const std::function<void()>& task);
+        void Wait();  //Blocks until there are no queued or running tasks.
+
+        size_t Size() const;
+
+        //The pool that all handles share, so that the number of threads doesn't grow with the number of open BSAs.
+        //Created on first use with one thread per hardware thread, and never destroyed.
+        static ThreadPool& Shared();
+    private:
+        void Work();
+
+        std::vector<std::thread> workers;
+        std::deque< std::function<void()> > tasks;
+        std::mutex mutex;
+        std::condition_variable taskQueued;
+        std::condition_variable tasksFinished;
+        size_t runningTasks;
+        bool stopping;
+    };
+
+    //A set of tasks run on the shared pool, which can be waited for without waiting for other users' tasks.
+    //Waiting from one of the pool's threads can deadlock, as the tasks waited for may be queued behind the waiting one.
+    class TaskGroup {
+    public:
+        TaskGroup();
+        ~TaskGroup();  //Waits for the group's tasks.
+
+        void Submit(const std::function<void()>& task);  //The pool is created by the first submission.
+        void Wait();  //Blocks until all the tasks submitted to the group have finished.
+    private:
+        std::mutex mutex;
+        std::condition_variable tasksFinished;
+        size_t pendingTasks;
+    };
+}
+
+#endif